@@ -1,6 +1,10 @@
 #include "ipc/basic_message.h"
 #include <cassert>
 #include <algorithm>
+#include <malloc.h>
+#if defined(_M_ARM64)
+#include <intrin.h>
+#endif
 
 
 namespace {
@@ -26,6 +30,22 @@ namespace {
 		return ((pid << 14) | (count & 0x3fff)) << 8;
 	}
 
+	// Reads a reference count with acquire semantics, so what the thread
+	// that dropped the other reference wrote to the message is visible
+	// before it is deleted here.
+	inline long LoadRefCount(volatile long* count) {
+#if defined(_M_IX86) || defined(_M_X64)
+		// Volatile reads are acquires under /volatile:ms.
+		return *count;
+#elif defined(_M_ARM64)
+		// They are not under /volatile:iso, the default there.
+		return static_cast<long>(__ldar32(
+			reinterpret_cast<volatile unsigned __int32*>(count)));
+#else
+		return InterlockedCompareExchange(count, 0, 0);
+#endif
+	}
+
 }  // namespace
 
 namespace IPC
@@ -39,19 +59,26 @@ namespace IPC
 
 	basic_message::~basic_message(void)
 	{
-		if (capacity_ != kCapacityReadOnly)
-			free(header_);
+		if (capacity_ != kCapacityReadOnly && !is_inline())
+			_aligned_free(header_);
 	}
 
 
+	// A message nobody else holds a reference to can not gain one from
+	// another thread, so the first reference and the last release skip the
+	// interlocked instructions. Messages built and consumed by one owner never
+	// pay for atomics.
 	void basic_message::AddRef() const
 	{
-		InterlockedIncrement(&ref_count_);
+		if (ref_count_ == 0)
+			ref_count_ = 1;
+		else
+			InterlockedIncrement(&ref_count_);
 	}
 
 	void basic_message::Release() const
 	{
-		if (InterlockedDecrement(&ref_count_) == 0)
+		if (LoadRefCount(&ref_count_) == 1 || InterlockedDecrement(&ref_count_) == 0)
 		{
 			delete this;
 		}
@@ -64,8 +91,10 @@ namespace IPC
 		, capacity_(0)
 		, ref_count_(0)
 		, variable_buffer_offset_(0)
+		, aligned_payload_(false)
 	{
-		Resize(kPayloadUnit);
+		header_ = reinterpret_cast<Header*>(inline_buffer_.bytes);
+		capacity_ = sizeof(inline_buffer_);
 
 		header()->payload_size = 0;
 		header()->routing = routing_id;
@@ -83,6 +112,7 @@ namespace IPC
 		, capacity_(kCapacityReadOnly)
 		, ref_count_(0)
 		, variable_buffer_offset_(0)
+		, aligned_payload_(false)
 	{
 
 		if (kHeaderSize > static_cast<unsigned int>(data_len))
@@ -93,6 +123,30 @@ namespace IPC
 	}
 
 
+	basic_message::basic_message(const basic_message& other)
+		: header_(NULL)
+		, capacity_(kCapacityReadOnly)
+		, ref_count_(0)
+		, variable_buffer_offset_(0)
+		, aligned_payload_(other.aligned_payload_)
+	{
+		if (!other.header_)
+			return;
+
+		header_ = reinterpret_cast<Header*>(inline_buffer_.bytes);
+		capacity_ = sizeof(inline_buffer_);
+		size_t size = other.size();
+		// Aligned data is only aligned in heap storage.
+		if ((size > capacity_ || aligned_payload_) && !Resize(size))
+		{
+			header_ = NULL;
+			capacity_ = kCapacityReadOnly;
+			return;
+		}
+		memcpy(header_, other.header_, size);
+	}
+
+
 	basic_message::Header* basic_message::header()
 	{
 		return static_cast<Header*>(header_);
@@ -191,6 +245,14 @@ namespace IPC
 		return header()->flags;
 	}
 
+	unsigned int basic_message::request_id() const {
+		return header()->flags >> 8;
+	}
+
+	void basic_message::set_request_id(unsigned int id) {
+		header()->flags = (header()->flags & 0xFF) | (id << 8);
+	}
+
 	//------------------------------------------------------------------------------
 	
 	void basic_message::SetHeaderValues(int routing, unsigned int type, unsigned int flags)
@@ -208,9 +270,21 @@ namespace IPC
 		new_capacity = AlignInt(new_capacity, kPayloadUnit);
 
 		assert(capacity_ != kCapacityReadOnly);
-		void* p = realloc(header_, new_capacity);
-		if (!p)
-			return false;
+		void* p;
+		if (is_inline())
+		{
+			// Spill to the heap; the inline buffer is never grown into.
+			p = _aligned_malloc(new_capacity, kPayloadAlignment);
+			if (!p)
+				return false;
+			memcpy(p, header_, (std::min)(capacity_, new_capacity));
+		}
+		else
+		{
+			p = _aligned_realloc(header_, new_capacity, kPayloadAlignment);
+			if (!p)
+				return false;
+		}
 
 		header_ = reinterpret_cast<Header*>(p);
 		capacity_ = new_capacity;
@@ -254,28 +328,67 @@ namespace IPC
 	}
 
 	bool basic_message::WriteBytes(const void* data, int data_len)
+	{
+		char* dest = ClaimBytes(data_len);
+		if (!dest)
+			return false;
+		memcpy(dest, data, data_len);
+		return true;
+	}
+
+	bool basic_message::WriteAlignedData(const char* data, int length)
+	{
+		char* dest = ClaimAlignedBytes(length);
+		if (!dest)
+			return false;
+		memcpy(dest, data, length);
+		return true;
+	}
+
+	char* basic_message::ClaimAlignedBytes(int length)
+	{
+		// Only heap buffers are allocated on kPayloadAlignment.
+		if (is_inline() && !Resize(capacity_))
+			return NULL;
+		if (length < 0 || !WriteInt(length))
+			return NULL;
+
+		size_t offset = kHeaderSize + header_->payload_size;
+		int padding = static_cast<int>(AlignInt(offset, kPayloadAlignment) - offset);
+		if (length > kintmax - padding)
+			return NULL;
+		char* dest = ClaimBytes(padding + length);
+		if (!dest)
+			return NULL;
+		memset(dest, 0, padding);
+		aligned_payload_ = true;
+		return dest + padding;
+	}
+
+	char* basic_message::ClaimBytes(int length)
 	{
 		assert(kCapacityReadOnly != capacity_);
+		if (length < 0)
+			return NULL;
 
 		size_t offset = header_->payload_size;
 
-		size_t new_size = offset + data_len;
+		size_t new_size = offset + length;
 		size_t needed_size = sizeof(Header) + new_size;
 		if (needed_size > capacity_ && !Resize((std::max)(capacity_ * 2, needed_size)))
-			return false;
+			return NULL;
 
 		header_->payload_size = static_cast<unsigned int>(new_size);
-		char* dest = const_cast<char*>(payload()) + offset;
-		memcpy(dest, data, data_len);
-		return true;
+		return const_cast<char*>(payload()) + offset;
 	}
 	
 	//------------------------------------------------------------------------------
 	//------------------------------------------------------------------------------
 	//------------------------------------------------------------------------------
 
-	MessageReader::MessageReader(basic_message* m)
-		: read_ptr_(m->payload())
+	MessageReader::MessageReader(const basic_message* m)
+		: message_ptr_(static_cast<const char*>(m->data()))
+		, read_ptr_(m->payload())
 		, read_end_ptr_(m->end_of_payload())
 	{
 
@@ -380,6 +493,23 @@ namespace IPC
 		return ReadBytes(data, *length);
 	}
 
+	bool MessageReader::ReadAlignedData(const char** data, int* length)
+	{
+		*length = 0;
+		*data = 0;
+
+		if (!ReadInt(length))
+			return false;
+
+		size_t offset = read_ptr_ - message_ptr_;
+		size_t alignment = basic_message::kPayloadAlignment;
+		int padding = static_cast<int>((alignment - offset % alignment) % alignment);
+		if (!GetReadPointerAndAdvance(padding))
+			return false;
+
+		return ReadBytes(data, *length);
+	}
+
 	bool MessageReader::ReadBytes(const char** data, int length)
 	{
 		const char* read_from = GetReadPointerAndAdvance(length);
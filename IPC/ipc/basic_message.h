@@ -4,6 +4,7 @@
 
 #pragma once
 #include "ipc/ipc_forwards.h"
+#include <type_traits>
 
 #define IPC_REPLY_ID 0xFFFFFFF0  // Special message id for replies
 
@@ -29,6 +30,17 @@ namespace IPC
 		// Bit values used in the flags field.
 		// Upper 24 bits of flags store a reference number, so this enum is limited to
 		// 8 bits.
+		// Alignment, relative to the start of the message, of data written with
+		// WriteAlignedData. Heap messages are allocated on this boundary and
+		// shared-memory records place such messages on it, so the data can be
+		// handed to SIMD code that expects cache-line aligned input.
+		enum { kPayloadAlignment = 64 };
+
+		// Messages whose header and payload fit in this many bytes are stored
+		// inside the object, saving the separate heap block. They move to the
+		// heap once they outgrow it or take aligned data.
+		enum { kInlineCapacity = 64 };
+
 		enum {
 			PRIORITY_MASK = 0x03,  // Low 2 bits of store the priority value.
 			SYNC_BIT = 0x04,
@@ -39,7 +51,8 @@ namespace IPC
 			HAS_SENT_TIME_BIT = 0x80,
 		};
 		basic_message(void);
-		~basic_message(void);
+		// Messages are deleted through Release(), typed subclasses included.
+		virtual ~basic_message(void);
 
 		// Initialize a message with a user-defined type, priority value, and
 		// destination WebView ID.
@@ -50,6 +63,11 @@ namespace IPC
 		// should be used on the message when initialized this way.
 		basic_message(const char* data, int data_len);
 
+		// Copies the header and payload of |other| into storage owned by the new
+		// message. Use it to keep a message handed to OnMessageReceived, which
+		// may point into a transport buffer, past the callback.
+		basic_message(const basic_message& other);
+
 		void AddRef() const;
 		void Release() const;
 
@@ -118,6 +136,13 @@ namespace IPC
 
 		unsigned int flags() const;
 
+		// Identifies a call and its reply. Stored in the upper 24 bits of the
+		// flags in place of the reference number, so it is only meaningful on
+		// messages with is_sync() or is_reply() set.
+		unsigned int request_id() const;
+
+		void set_request_id(unsigned int id);
+
 	public:
 
 		// Sets all the given header values. The message should be empty at this
@@ -154,6 +179,21 @@ namespace IPC
 		// when reading and writing. It is normally used to serialize PoD types of a
 		// known size. See also WriteData.
 		bool WriteBytes(const void* data, int data_len);
+		// Grows the payload by |length| bytes behind a single capacity check and
+		// returns where they start, or NULL on failure. The caller fills them in.
+		// Used to write several fields whose total size is known up front.
+		char* ClaimBytes(int length);
+		// "AlignedData" is a blob with a length whose bytes start on a
+		// kPayloadAlignment boundary; zero padding is written between the length
+		// and the bytes. Read it back with MessageReader::ReadAlignedData.
+		bool WriteAlignedData(const char* data, int length);
+		// Claims |length| bytes laid out like WriteAlignedData and returns the
+		// aligned start, so the caller can produce the data in place.
+		char* ClaimAlignedBytes(int length);
+
+		// True once aligned data has been written; transports keep the start of
+		// such messages on a kPayloadAlignment boundary.
+		bool has_aligned_payload() const { return aligned_payload_; }
 
 		// Find the end of the message data that starts at range_start.  Returns NULL
 		// if the entire message is not found in the given data range.
@@ -180,17 +220,77 @@ namespace IPC
 		size_t variable_buffer_offset_;  // IF non-zero, then offset to a buffer.
 
 		Header* header_;
+
+		bool aligned_payload_;
+
+		// Storage for small messages; |header_| points here until the message
+		// outgrows it. The union keeps the header 8-byte aligned.
+		union InlineBuffer {
+			char bytes[kInlineCapacity];
+			long long align;
+		} inline_buffer_;
+
+		bool is_inline() const {
+			return header_ == reinterpret_cast<const Header*>(inline_buffer_.bytes);
+		}
 	private:
-		mutable long ref_count_;
+		mutable volatile long ref_count_;
 	};
 
 	//------------------------------------------------------------------------------
 
+	// A read-only view of |size| elements that live in a message payload. The
+	// elements are not copied, so the view is only valid while the message is,
+	// and they keep the alignment they have in the payload.
+	template <class T>
+	class ArrayView
+	{
+	public:
+		ArrayView() : data_(NULL), size_(0) {}
+		ArrayView(const T* data, size_t size) : data_(data), size_(size) {}
+
+		const T* data() const { return data_; }
+		size_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+		const T& operator[](size_t i) const { return data_[i]; }
+		const T* begin() const { return data_; }
+		const T* end() const { return data_ + size_; }
+
+	private:
+		const T* data_;
+		size_t size_;
+	};
+
+	namespace internal {
+
+		template <class... Types>
+		struct SizeOfAll;
+
+		template <>
+		struct SizeOfAll<> {
+			static constexpr size_t value = 0;
+		};
+
+		template <class Type, class... Types>
+		struct SizeOfAll<Type, Types...> {
+			static constexpr size_t value = sizeof(Type) + SizeOfAll<Types...>::value;
+		};
+
+		inline void CopyEach(const char*) {}
+
+		template <class Type, class... Types>
+		inline void CopyEach(const char* from, Type* result, Types*... results) {
+			memcpy(result, from, sizeof(Type));
+			CopyEach(from + sizeof(Type), results...);
+		}
+
+	}  // namespace internal
+
 	class MessageReader
 	{
 	public:
-		MessageReader() : read_ptr_(NULL), read_end_ptr_(NULL) {}
-		explicit MessageReader(basic_message* m);
+		MessageReader() : message_ptr_(NULL), read_ptr_(NULL), read_end_ptr_(NULL) {}
+		explicit MessageReader(const basic_message* m);
 
 		// Methods for reading the payload of the Pickle. To read from the start of
 		// the Pickle, create a PickleIterator from a Pickle. If successful, these
@@ -207,6 +307,51 @@ namespace IPC
 		bool ReadWString(std::wstring* result);
 		bool ReadData(const char** data, int* length);
 		bool ReadBytes(const char** data, int length);
+		// Reads data written with WriteAlignedData. |data| is aligned to
+		// kPayloadAlignment whenever the message itself starts on that boundary,
+		// which holds for heap messages and for messages read from shared memory.
+		bool ReadAlignedData(const char** data, int* length);
+
+		// Reads consecutive fixed-size fields with a single bounds check for
+		// their combined size, e.g. reader.ReadFixed(&id, &x, &y, &stamp).
+		// Nothing is consumed if the payload is too short. The types must be
+		// trivially copyable and are read as their raw bytes, so bool here is
+		// one byte as in ReadBool.
+		template <class... Types>
+		bool ReadFixed(Types*... results)
+		{
+			const char* read_from = GetReadPointerAndAdvance(
+				static_cast<int>(internal::SizeOfAll<Types...>::value));
+			if (!read_from)
+				return false;
+			internal::CopyEach(read_from, results...);
+			return true;
+		}
+
+		// Returns a view of the next |count| elements of T without copying them.
+		template <class T>
+		bool ReadArray(int count, ArrayView<T>* result)
+		{
+			static_assert(std::is_trivially_copyable<T>::value,
+				"ReadArray needs a trivially copyable element type");
+			if (count < 0 || static_cast<size_t>(count) > kintmax / sizeof(T))
+				return false;
+			const char* read_from =
+				GetReadPointerAndAdvance(static_cast<int>(count * sizeof(T)));
+			if (!read_from)
+				return false;
+			*result = ArrayView<T>(reinterpret_cast<const T*>(read_from), count);
+			return true;
+		}
+
+		// Reads an int element count followed by that many elements, the layout
+		// WriteParams uses for std::vector.
+		template <class T>
+		bool ReadArray(ArrayView<T>* result)
+		{
+			int count;
+			return ReadInt(&count) && ReadArray(count, result);
+		}
 
 
 	private:
@@ -219,6 +364,7 @@ namespace IPC
 			size_t size_element);
 
 		// Pointers to the Pickle data.
+		const char* message_ptr_;
 		const char* read_ptr_;
 		const char* read_end_ptr_;
 	};
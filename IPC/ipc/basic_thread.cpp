@@ -1,23 +1,110 @@
 #include "ipc/basic_thread.h"
+#include <algorithm>
+#include <malloc.h>
+
+namespace {
+
+	// Upper bound on idle PendingTask blocks kept for reuse.
+	const USHORT kMaxCachedTasks = 4096;
+
+	// Freed PendingTask blocks, shared by all threads. The SList is lock-free
+	// and safe against ABA, so producers on any thread can take blocks that
+	// a loop thread gave back. Blocks still cached at exit are not freed.
+	struct TaskNodeCache {
+		TaskNodeCache() { ::InitializeSListHead(&head); }
+		SLIST_HEADER head;
+	};
+
+	TaskNodeCache& NodeCache()
+	{
+		static TaskNodeCache cache;
+		return cache;
+	}
+
+	void ApplyThreadOptions(const IPC::ThreadOptions& options)
+	{
+		HANDLE thread = ::GetCurrentThread();
+		if (options.affinity_mask)
+		{
+			GROUP_AFFINITY affinity = {};
+			affinity.Mask = options.affinity_mask;
+			affinity.Group = options.processor_group;
+			::SetThreadGroupAffinity(thread, &affinity, NULL);
+		}
+		if (options.priority != THREAD_PRIORITY_NORMAL)
+			::SetThreadPriority(thread, options.priority);
+		if (!options.mmcss_task.empty())
+		{
+			// avrt.dll stays loaded; the registration ends with the thread.
+			typedef HANDLE(WINAPI* AvSetMmThreadCharacteristicsFn)(LPCWSTR, LPDWORD);
+			if (HMODULE avrt = ::LoadLibraryW(L"avrt.dll"))
+			{
+				AvSetMmThreadCharacteristicsFn set_characteristics =
+					reinterpret_cast<AvSetMmThreadCharacteristicsFn>(
+						::GetProcAddress(avrt, "AvSetMmThreadCharacteristicsW"));
+				DWORD task_index = 0;
+				if (set_characteristics)
+					set_characteristics(options.mmcss_task.c_str(), &task_index);
+			}
+		}
+		if (!options.name.empty())
+			IPC::SetCurrentThreadName(options.name);
+	}
+
+}  // namespace
 namespace IPC
 {
 
+	void* basic_thread::PendingTask::operator new(size_t size)
+	{
+		// Every block has the size of a PendingTask; the SList entry overlays
+		// its first bytes while it is cached.
+		if (PSLIST_ENTRY entry = ::InterlockedPopEntrySList(&NodeCache().head))
+			return entry;
+		void* p = _aligned_malloc(size, MEMORY_ALLOCATION_ALIGNMENT);
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void basic_thread::PendingTask::operator delete(void* p)
+	{
+		if (!p)
+			return;
+		TaskNodeCache& cache = NodeCache();
+		if (::QueryDepthSList(&cache.head) < kMaxCachedTasks)
+			::InterlockedPushEntrySList(&cache.head, static_cast<PSLIST_ENTRY>(p));
+		else
+			_aligned_free(p);
+	}
+
 	basic_thread::basic_thread(void)
 		: thread_(NULL)
 		, wait_event_(NULL)
 		, should_quit_(false)
+		, sleeping_(0)
+		, next_timer_id_(0)
 	{
 		wait_event_ = ::CreateEvent(NULL, TRUE, TRUE, NULL);
 	}
 
 	basic_thread::~basic_thread(void)
 	{
+		while (PendingTask* pending = task_queue_.Pop())
+			delete pending;
+		while (!delayed_queue_.empty())
+		{
+			delete delayed_queue_.top();
+			delayed_queue_.pop();
+		}
 		CloseHandle(wait_event_);
 	}
 
 	DWORD WINAPI basic_thread::ThreadMain(LPVOID params)
 	{
-		static_cast<basic_thread*>(params)->Run();
+		basic_thread* self = static_cast<basic_thread*>(params);
+		ApplyThreadOptions(self->options_);
+		self->Run();
 		return 0;
 	}
 
@@ -27,34 +114,87 @@ namespace IPC
 		{
 			bool more_work_is_plausible = DoScheduledWork();
 			if (should_quit_) break;
+			more_work_is_plausible |= DoDelayedWork();
+			if (should_quit_) break;
 			more_work_is_plausible |= DoMoreWork();
 			if (more_work_is_plausible) continue;
 			if (should_quit_) break;
+			if (!PrepareToSleep()) continue;
 			WaitForWork();  // Wait (sleep) until we have work to do again.
+			InterlockedExchange(&sleeping_, 0);
 		}
 	}
 
 	bool basic_thread::DoScheduledWork()
 	{
-		std::deque<Task> work_queue;
+		while (PendingTask* pending = task_queue_.Pop())
 		{
-			AutoLock lock(task_mutex_);
-			if (task_queue_.empty())
-				return false;
-			work_queue.swap(task_queue_);
+			if (pending->cancel)
+			{
+				live_timers_.erase(pending->timer_id);
+				delete pending;
+				continue;
+			}
+			if (pending->run_time)
+			{
+				live_timers_.insert(pending->timer_id);
+				delayed_queue_.push(pending);
+				continue;
+			}
+			Task t = std::move(pending->task);
+			delete pending;
+
+			t();
 		}
 
-		do
+		return false;
+	}
+
+	bool basic_thread::DoDelayedWork()
+	{
+		ipc_ull now = ::GetTickCount64();
+		while (!delayed_queue_.empty() && delayed_queue_.top()->run_time <= now)
 		{
-			Task t = work_queue.front();
-			work_queue.pop_front();
+			PendingTask* pending = delayed_queue_.top();
+			delayed_queue_.pop();
+			if (!live_timers_.count(pending->timer_id))
+			{
+				delete pending;  // cancelled
+				continue;
+			}
+			if (!pending->interval)
+			{
+				live_timers_.erase(pending->timer_id);
+				Task t = std::move(pending->task);
+				delete pending;
 
-			t();
-		} while (!work_queue.empty());
+				t();
+				continue;
+			}
+			// Re-arm before running so the task can cancel itself. The heap
+			// only changes on this thread, so |pending| stays valid meanwhile.
+			pending->run_time += pending->interval;
+			if (pending->run_time <= now)
+				pending->run_time = now + pending->interval;
+			delayed_queue_.push(pending);
 
+			pending->task();
+		}
 		return false;
 	}
 
+	DWORD basic_thread::DelayedWorkTimeout() const
+	{
+		if (delayed_queue_.empty())
+			return INFINITE;
+		ipc_ull now = ::GetTickCount64();
+		ipc_ull run_time = delayed_queue_.top()->run_time;
+		if (run_time <= now)
+			return 0;
+		// Stay below INFINITE; a long wait just ends early and waits again.
+		return static_cast<DWORD>((std::min)(run_time - now, static_cast<ipc_ull>(INFINITE - 1)));
+	}
+
 	void basic_thread::ScheduleWork()
 	{
 		//warkup thread
@@ -68,19 +208,71 @@ namespace IPC
 
 	void basic_thread::WaitForWork()
 	{
-		int timeout = INFINITE;
+		DWORD timeout = DelayedWorkTimeout();
 		//do timeout check
 		::WaitForSingleObject(wait_event_, timeout);
 		::ResetEvent(wait_event_);
 	}
 
-	void basic_thread::PostTask(const Task& task)
+	bool basic_thread::PrepareToSleep()
 	{
-		{
-			AutoLock lock(task_mutex_);
-			task_queue_.push_back(task);
-		}
-		ScheduleWork();
+		// The exchange orders the flag before the emptiness check, and the push
+		// orders the task before the producer's flag check, so either we see the
+		// task here or the producer sees the flag and wakes us.
+		InterlockedExchange(&sleeping_, 1);
+		if (task_queue_.IsEmpty())
+			return true;
+		InterlockedExchange(&sleeping_, 0);
+		return false;
+	}
+
+	void basic_thread::PostTask(Task task)
+	{
+		PostPendingTask(new PendingTask(std::move(task)));
+	}
+
+	basic_thread::TimerId basic_thread::PostDelayedTask(Task task, DWORD delay_ms)
+	{
+		PendingTask* pending = new PendingTask(std::move(task));
+		pending->run_time = ::GetTickCount64() + delay_ms;
+		pending->timer_id = static_cast<TimerId>(InterlockedIncrement64(&next_timer_id_));
+		TimerId id = pending->timer_id;
+		PostPendingTask(pending);
+		return id;
+	}
+
+	basic_thread::TimerId basic_thread::PostRepeatingTask(Task task, DWORD interval_ms)
+	{
+		PendingTask* pending = new PendingTask(std::move(task));
+		// A zero interval would keep DoDelayedWork from ever returning.
+		pending->interval = (std::max)(interval_ms, static_cast<DWORD>(1));
+		pending->run_time = ::GetTickCount64() + pending->interval;
+		pending->timer_id = static_cast<TimerId>(InterlockedIncrement64(&next_timer_id_));
+		TimerId id = pending->timer_id;
+		PostPendingTask(pending);
+		return id;
+	}
+
+	void basic_thread::CancelTimer(TimerId id)
+	{
+		// Goes through the task queue so it is ordered after the timer itself.
+		PendingTask* pending = new PendingTask(Task());
+		pending->timer_id = id;
+		pending->cancel = true;
+		PostPendingTask(pending);
+	}
+
+	void basic_thread::WakeUp()
+	{
+		if (InterlockedCompareExchange(&sleeping_, 0, 1) == 1)
+			ScheduleWork();
+	}
+
+	void basic_thread::PostPendingTask(PendingTask* pending)
+	{
+		task_queue_.Push(pending);
+		if (InterlockedCompareExchange(&sleeping_, 0, 1) == 1)
+			ScheduleWork();
 	}
 
 	void basic_thread::Start()
@@ -95,7 +287,7 @@ namespace IPC
 	void basic_thread::Stop()
 	{
 		should_quit_ = true;
-		::SetEvent(wait_event_);
+		ScheduleWork();
 		if (thread_)
 		{
 			::WaitForSingleObject(thread_, 1000);
@@ -104,6 +296,16 @@ namespace IPC
 		}
 	}
 
+	void basic_thread::SetOptions(const ThreadOptions& options)
+	{
+		options_ = options;
+	}
+
+	bool basic_thread::RunsOnCurrentThread() const
+	{
+		return thread_ != NULL && ::GetThreadId(thread_) == ::GetCurrentThreadId();
+	}
+
 	void basic_thread::Wait(DWORD timeout)
 	{
 		::WaitForSingleObject(thread_, timeout);
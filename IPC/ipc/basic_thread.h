@@ -1,39 +1,149 @@
 #pragma once
 #include "ipc/ipc_utils.h"
+#include "ipc/ipc_mpsc_queue.h"
+#include "ipc/ipc_task.h"
 
-#include <functional>
 #include <queue>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
 namespace IPC
 {
+	// Placement, scheduling and identity of a thread. The thread applies them
+	// to itself as it starts.
+	struct ThreadOptions {
+		ThreadOptions()
+			: affinity_mask(0), processor_group(0), priority(THREAD_PRIORITY_NORMAL) {}
+
+		// Processors of |processor_group| the thread may run on. 0 lets it
+		// migrate freely.
+		DWORD_PTR affinity_mask;
+		WORD processor_group;
+
+		// A THREAD_PRIORITY_* value. Levels above THREAD_PRIORITY_HIGHEST
+		// only take effect as far as the process priority class allows.
+		int priority;
+
+		// Registers the thread with the multimedia class scheduler under this
+		// task, e.g. L"Pro Audio", which lifts it into the real-time range
+		// without administrator rights. Ignored where MMCSS is unavailable.
+		std::wstring mmcss_task;
+
+		// Shown by debuggers and profilers.
+		std::wstring name;
+	};
+
 	class basic_thread
 	{
 	public:
-		typedef std::function<void(void)> Task;
+		typedef UniqueTask Task;
+		// Identifies a delayed or repeating task for CancelTimer. Never 0.
+		typedef ipc_ull TimerId;
 	
 		basic_thread(void);
-		~basic_thread(void);
+		virtual ~basic_thread(void);
 
 		virtual void Start();
 		virtual void Stop();
 		virtual void Wait(DWORD timeout);
 
-		virtual void PostTask(const Task& task);
+		// Takes effect at the next Start.
+		virtual void SetOptions(const ThreadOptions& options);
+
+		// True when called from this thread.
+		virtual bool RunsOnCurrentThread() const;
+		// True when called from the thread that runs posted tasks, so a
+		// task posted here would wait for the caller to return.
+		virtual bool RunsTasksOnCurrentThread() const { return RunsOnCurrentThread(); }
+
+		// Makes a sleeping loop run once more without posting a task, for
+		// producers that hand work over through queues of their own. May be
+		// called from any thread; does nothing if the loop is awake.
+		virtual void WakeUp();
+
+		// May be called from any thread. Does not take a lock, and only enters
+		// the kernel when the loop has said it is about to sleep.
+		virtual void PostTask(Task task);
+
+		// Runs |task| on this thread once |delay_ms| milliseconds have passed.
+		TimerId PostDelayedTask(Task task, DWORD delay_ms);
+
+		// Runs |task| on this thread every |interval_ms| milliseconds, starting
+		// one interval from now, until the timer is cancelled. Runs that fall
+		// behind are skipped rather than bunched up.
+		TimerId PostRepeatingTask(Task task, DWORD interval_ms);
+
+		// Stops a delayed or repeating task from running again. May be called
+		// from any thread, including from the task itself; a run that has
+		// already started is not interrupted. Unknown ids are ignored.
+		void CancelTimer(TimerId id);
 
 	protected:
+		struct PendingTask : MpscQueueNode {
+			explicit PendingTask(Task t)
+				: task(std::move(t)), run_time(0), interval(0), timer_id(0), cancel(false) {}
+			Task task;
+			// GetTickCount64() time to run at, 0 for immediate tasks.
+			ipc_ull run_time;
+			// Period of a repeating task, 0 for one-shot tasks.
+			DWORD interval;
+			TimerId timer_id;
+			// Marks a request to cancel |timer_id| rather than a task.
+			bool cancel;
+
+			// Nodes are recycled through a lock-free cache, so a steady stream
+			// of posts does not allocate.
+			static void* operator new(size_t size);
+			static void operator delete(void* p);
+		};
+
+		// Orders the timer heap by run time, then by posting order.
+		struct LaterRunTime {
+			bool operator()(const PendingTask* a, const PendingTask* b) const {
+				if (a->run_time != b->run_time)
+					return a->run_time > b->run_time;
+				return a->timer_id > b->timer_id;
+			}
+		};
 
 		static DWORD WINAPI ThreadMain(LPVOID params);
 
 		virtual void Run();
 		virtual bool DoScheduledWork();
+		// Runs the delayed tasks that are due.
+		bool DoDelayedWork();
 		virtual void ScheduleWork();
 		virtual bool DoMoreWork();
 		virtual void WaitForWork();
 
+		// Publishes |sleeping_| and checks the queue once more. Returns false if
+		// a task slipped in, in which case the loop must not wait.
+		bool PrepareToSleep();
+
+		// How long WaitForWork may sleep before the next delayed task is due:
+		// INFINITE when there is none, 0 when one is overdue.
+		DWORD DelayedWorkTimeout() const;
+
+		// Hands |pending| to the loop that runs this thread's tasks.
+		virtual void PostPendingTask(PendingTask* pending);
+
 		HANDLE thread_;
+		ThreadOptions options_;
 		bool should_quit_;
-		Lock task_mutex_;
 		HANDLE wait_event_;
-		std::deque<Task> task_queue_;
+		MpscQueue<PendingTask> task_queue_;
+		// Set by the loop just before WaitForWork. A producer that finds it set
+		// clears it and calls ScheduleWork; while it is clear the loop is awake
+		// and will reach the task without being signalled.
+		volatile long sleeping_;
+
+		volatile long long next_timer_id_;
+		// Timers the loop has accepted and not finished or cancelled. Both are
+		// only touched on the loop thread; heap entries whose id is missing
+		// here are dropped when they reach the top.
+		std::priority_queue<PendingTask*, std::vector<PendingTask*>, LaterRunTime> delayed_queue_;
+		std::unordered_set<TimerId> live_timers_;
 	};
 
 
@@ -0,0 +1,88 @@
+#include "ipc/ipc_async.h"
+#include "ipc/ipc_endpoint.h"
+#include "ipc/basic_thread.h"
+
+namespace IPC
+{
+	namespace internal {
+
+		void Resumer::Resume(basic_thread* thread)
+		{
+			void* address = address_;
+			void(*resume)(void*) = resume_;
+			if (thread)
+				thread->PostTask([resume, address]() { resume(address); });
+			else
+				resume(address);
+		}
+
+	}  // namespace internal
+
+	SendOperation::SendOperation(Endpoint* endpoint, Message* message, basic_thread* resume_on)
+		: endpoint_(endpoint)
+		, message_(message)
+		, resume_on_(resume_on)
+		, written_(false)
+	{
+	}
+
+	SendOperation::SendOperation(SendOperation&& other)
+		: endpoint_(other.endpoint_)
+		, message_(std::move(other.message_))
+		, resume_on_(other.resume_on_)
+		, written_(other.written_)
+		, resumer_(other.resumer_)
+	{
+	}
+
+	bool SendOperation::Start()
+	{
+		// OnWritten may run on the IO thread before this returns, so |this|
+		// is not touched once the send is accepted.
+		return endpoint_->SendAndNotify(message_.get(), &SendOperation::OnWritten, this);
+	}
+
+	void SendOperation::OnWritten(void* context, bool written)
+	{
+		SendOperation* operation = static_cast<SendOperation*>(context);
+		operation->written_ = written;
+		operation->resumer_.Resume(operation->resume_on_);
+	}
+
+	CallOperation::CallOperation(Endpoint* endpoint, Message* request, basic_thread* resume_on,
+		DWORD timeout_ms)
+		: endpoint_(endpoint)
+		, request_(request)
+		, resume_on_(resume_on)
+		, timeout_ms_(timeout_ms)
+	{
+		call_.complete = &CallOperation::OnReply;
+		call_.context = this;
+	}
+
+	CallOperation::CallOperation(CallOperation&& other)
+		: endpoint_(other.endpoint_)
+		, request_(std::move(other.request_))
+		, reply_(std::move(other.reply_))
+		, resume_on_(other.resume_on_)
+		, timeout_ms_(other.timeout_ms_)
+		, resumer_(other.resumer_)
+	{
+		call_.complete = &CallOperation::OnReply;
+		call_.context = this;
+	}
+
+	bool CallOperation::Start()
+	{
+		return endpoint_->StartCall(request_.get(), &call_, timeout_ms_);
+	}
+
+	void CallOperation::OnReply(PendingCall* call, Message* reply)
+	{
+		CallOperation* operation = static_cast<CallOperation*>(call->context);
+		// The reply may point into the transport's buffer.
+		if (reply)
+			operation->reply_ = new Message(*reply);
+		operation->resumer_.Resume(operation->resume_on_);
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+#include "ipc/ipc_msg.h"
+#include "ipc/ipc_pending_call.h"
+
+namespace IPC
+{
+	class Endpoint;
+	class basic_thread;
+
+	// Awaitables returned by Endpoint::SendAsync and Endpoint::Call:
+	//
+	//   bool written = co_await endpoint.SendAsync(message);
+	//   ScopedPtr<Message> reply = co_await endpoint.Call(request);
+	//
+	// The coroutine resumes on the endpoint's IO thread, inside the
+	// completion, or on |resume_on| through a single posted task. The state
+	// lives in the awaitable, which stays in the coroutine frame while it is
+	// suspended, so nothing is allocated per await. await_suspend takes any
+	// coroutine handle type, so no coroutine header is needed here and both
+	// std::coroutine_handle and std::experimental::coroutine_handle work.
+	namespace internal {
+
+		// Remembers a suspended coroutine without naming its handle type.
+		class Resumer
+		{
+		public:
+			Resumer() : address_(NULL), resume_(NULL) {}
+
+			template <class Handle>
+			void Set(Handle handle)
+			{
+				address_ = handle.address();
+				resume_ = &ResumeHandle<Handle>;
+			}
+
+			// Resumes the coroutine here, or posts that to |thread|. The
+			// awaitable may be gone once this returns.
+			void Resume(basic_thread* thread);
+
+		private:
+			template <class Handle>
+			static void ResumeHandle(void* address)
+			{
+				Handle::from_address(address).resume();
+			}
+
+			void* address_;
+			void(*resume_)(void*);
+		};
+
+	}  // namespace internal
+
+	class SendOperation
+	{
+	public:
+		SendOperation(SendOperation&& other);
+
+		bool await_ready() const { return false; }
+
+		template <class Handle>
+		bool await_suspend(Handle handle)
+		{
+			resumer_.Set(handle);
+			return Start();
+		}
+
+		// True once the message was handed to the pipe or written to the
+		// segment; false if it was refused or thrown away on close.
+		bool await_resume() const { return written_; }
+
+	private:
+		friend class Endpoint;
+
+		SendOperation(Endpoint* endpoint, Message* message, basic_thread* resume_on);
+
+		// Returns false, without suspending, if the message was refused.
+		bool Start();
+		static void OnWritten(void* context, bool written);
+
+		Endpoint* endpoint_;
+		ScopedPtr<Message> message_;
+		basic_thread* resume_on_;
+		bool written_;
+		internal::Resumer resumer_;
+
+		DISALLOW_COPY_AND_ASSIGN(SendOperation);
+	};
+
+	class CallOperation
+	{
+	public:
+		CallOperation(CallOperation&& other);
+
+		bool await_ready() const { return false; }
+
+		template <class Handle>
+		bool await_suspend(Handle handle)
+		{
+			resumer_.Set(handle);
+			return Start();
+		}
+
+		// The reply, or NULL if the call could not be sent, expired, or the
+		// endpoint lost its peer before the reply came.
+		ScopedPtr<Message> await_resume() { return std::move(reply_); }
+
+	private:
+		friend class Endpoint;
+
+		CallOperation(Endpoint* endpoint, Message* request, basic_thread* resume_on,
+			DWORD timeout_ms);
+
+		bool Start();
+		static void OnReply(PendingCall* call, Message* reply);
+
+		Endpoint* endpoint_;
+		ScopedPtr<Message> request_;
+		ScopedPtr<Message> reply_;
+		basic_thread* resume_on_;
+		DWORD timeout_ms_;
+		PendingCall call_;
+		internal::Resumer resumer_;
+
+		DISALLOW_COPY_AND_ASSIGN(CallOperation);
+	};
+}
@@ -1,32 +1,128 @@
 #pragma once
 #include "ipc/ipc_forwards.h"
 #include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
 #include "ipc_messager.h"
 
 namespace IPC
 {
+	// Outcome of writing out a transport's queue on shutdown.
+	struct DrainResult {
+		// Queued messages handed to the pipe or written to the segment.
+		size_t flushed;
+		// Queued messages still unwritten when the deadline passed.
+		size_t dropped;
+		// True if the peer confirmed it has read everything flushed.
+		bool acknowledged;
+	};
 
 	class BasicIterPC : public Sender
 	{
 	public:
+		// Told whether the messages it waited for were written (true) or
+		// thrown away when the transport closed (false).
+		typedef void(*WriteCallback)(void* context, bool written);
+
 		BasicIterPC(const ipc_tstring& name,
 			Receiver* receiver, basic_thread* thread)
 			:peer_pid_(0),name_(name), receiver_(receiver), bthread_(thread)
+			, messages_queued_(0), messages_written_(0)
 		{}
-		~BasicIterPC(void) {}
+		virtual ~BasicIterPC(void) {}
 
 		virtual bool Connect() = 0;
 		virtual void Close() = 0;
 		virtual bool Send(Message* message) override = 0;
+		// Queues |count| messages, taking their references, before writing
+		// any, so transports can write them together. Returns false if the
+		// transport failed.
+		virtual bool SendBatch(ScopedPtr<Message>* messages, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (!Send(messages[i].get()))
+					return false;
+			}
+			return true;
+		}
+		// Writes out the queued messages and waits for the peer to read them,
+		// returning early once it has or when GetTickCount64() reaches
+		// |deadline|. Runs on the transport's thread.
+		virtual DrainResult Drain(ipc_ull deadline) = 0;
+
+		// Queues |message| from any thread straight into the transport's
+		// output queue, waking the transport's thread at most once per burst.
+		// Returns false if the transport only takes Send on its own thread.
+		virtual bool Enqueue(const ScopedPtr<Message>& message) { return false; }
+
 		DWORD peer_pid() const { return peer_pid_; }
+
+		// Calls |callback| once every message queued by Send so far has been
+		// handed to the pipe or written to the segment; at once if none is
+		// pending. Runs on the transport's thread.
+		void NotifyWhenWritten(WriteCallback callback, void* context)
+		{
+			AcceptEnqueued();
+			if (messages_written_ >= messages_queued_)
+			{
+				callback(context, true);
+				return;
+			}
+			WriteWaiter waiter = { messages_queued_, callback, context };
+			write_waiters_.push(waiter);
+		}
 	protected:
+		// Transports count every message entering and leaving their output
+		// queue.
+		void MessageQueued() { ++messages_queued_; }
+		void MessageWritten() { ++messages_written_; }
+
+		// Moves the messages taken by Enqueue into the output queue. Runs on
+		// the transport's thread.
+		virtual void AcceptEnqueued() {}
+
+		// Calls back the waiters whose messages are out. Transports call it
+		// where a callback may send again, not from inside their write pass.
+		void RunWriteCallbacks()
+		{
+			while (!write_waiters_.empty() &&
+				write_waiters_.front().target <= messages_written_)
+			{
+				WriteWaiter waiter = write_waiters_.front();
+				write_waiters_.pop();
+				waiter.callback(waiter.context, true);
+			}
+		}
+
+		// Fails every waiter once the output queue has been thrown away.
+		void DiscardQueued()
+		{
+			messages_queued_ = messages_written_;
+			while (!write_waiters_.empty())
+			{
+				WriteWaiter waiter = write_waiters_.front();
+				write_waiters_.pop();
+				waiter.callback(waiter.context, false);
+			}
+		}
+
 		DWORD peer_pid_;
 
 		ipc_tstring name_;
 		Receiver* receiver_;
 		basic_thread* bthread_;
 
+		ipc_ull messages_queued_;
+		ipc_ull messages_written_;
+
 	private:
+		struct WriteWaiter {
+			ipc_ull target;
+			WriteCallback callback;
+			void* context;
+		};
+		FifoQueue<WriteWaiter> write_waiters_;
+
 		DISALLOW_COPY_AND_ASSIGN(BasicIterPC);
 	};
 
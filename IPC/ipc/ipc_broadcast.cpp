@@ -0,0 +1,149 @@
+#include "ipc/ipc_broadcast.h"
+#include "ipc/ipc_endpoint.h"
+#include "ipc/ipc_shared_bus.h"
+#include "ipc/ipc_msg.h"
+#include <algorithm>
+#include <iterator>
+
+namespace IPC
+{
+	struct BroadcastGroup::Members {
+		Members() : refs(0) {}
+		void AddRef() const { ::InterlockedIncrement(&refs); }
+		void Release() const
+		{
+			if (!::InterlockedDecrement(&refs))
+				delete this;
+		}
+
+		mutable volatile long refs;
+		std::vector<Endpoint*> endpoints;
+	};
+
+	BroadcastGroup::BroadcastGroup(Delegate* delegate)
+		: delegate_(delegate)
+		, members_(new Members)
+		, bus_(NULL)
+		, next_ticket_(0)
+	{
+	}
+
+	BroadcastGroup::~BroadcastGroup()
+	{
+	}
+
+	void BroadcastGroup::AddMember(Endpoint* member)
+	{
+		AutoLock lock(lock_);
+		const std::vector<Endpoint*>& current = members_->endpoints;
+		if (std::find(current.begin(), current.end(), member) != current.end())
+			return;
+		ScopedPtr<Members> members(new Members);
+		members->endpoints.reserve(current.size() + 1);
+		members->endpoints = current;
+		members->endpoints.push_back(member);
+		members_ = members;
+	}
+
+	void BroadcastGroup::RemoveMember(Endpoint* member)
+	{
+		{
+			AutoLock lock(lock_);
+			const std::vector<Endpoint*>& current = members_->endpoints;
+			if (std::find(current.begin(), current.end(), member) != current.end())
+			{
+				ScopedPtr<Members> members(new Members);
+				std::remove_copy(current.begin(), current.end(),
+					std::back_inserter(members->endpoints), member);
+				members_ = members;
+			}
+		}
+		// Also when another thread, e.g. the delegate, removed it first.
+		WaitForSends();
+	}
+
+	size_t BroadcastGroup::member_count() const
+	{
+		AutoLock lock(lock_);
+		return members_->endpoints.size();
+	}
+
+	void BroadcastGroup::set_bus(SharedBusPublisher* bus)
+	{
+		{
+			AutoLock lock(lock_);
+			bus_ = bus;
+		}
+		WaitForSends();
+	}
+
+	ipc_ull BroadcastGroup::EnterSend()
+	{
+		ipc_ull ticket = next_ticket_++;
+		sending_.push_back(ticket);
+		return ticket;
+	}
+
+	void BroadcastGroup::LeaveSend(ipc_ull ticket)
+	{
+		AutoLock lock(lock_);
+		sending_.erase(std::find(sending_.begin(), sending_.end(), ticket));
+	}
+
+	void BroadcastGroup::WaitForSends()
+	{
+		ipc_ull changed;
+		{
+			AutoLock lock(lock_);
+			changed = next_ticket_;
+		}
+		// Sends are short next to a membership change; wait them out. Those
+		// started since read the new members and are not waited for.
+		for (;;)
+		{
+			{
+				AutoLock lock(lock_);
+				if (sending_.empty() ||
+					*std::min_element(sending_.begin(), sending_.end()) >= changed)
+					return;
+			}
+			Sleep(1);
+		}
+	}
+
+	bool BroadcastGroup::Send(Message* message)
+	{
+		// Every member takes and drops its own reference; hold one for the
+		// whole loop so the message outlives members that reject it.
+		ScopedPtr<Message> m(message);
+		ScopedPtr<Members> members;
+		SharedBusPublisher* bus;
+		ipc_ull ticket;
+		{
+			AutoLock lock(lock_);
+			members = members_;
+			bus = bus_;
+			ticket = EnterSend();
+		}
+		// Other senders and membership changes do not wait on these.
+		const std::vector<Endpoint*>& endpoints = members->endpoints;
+		std::vector<Endpoint*> failed;
+		for (size_t i = 0; i < endpoints.size(); ++i)
+		{
+			// Endpoint::Send only queues a reference for the IO thread.
+			if (!endpoints[i]->Send(m.get()))
+				failed.push_back(endpoints[i]);
+		}
+		// One copy into the ring, whatever the number of subscribers.
+		bool bus_failed = bus && !bus->Send(m.get());
+		LeaveSend(ticket);
+		if (delegate_)
+		{
+			for (size_t i = 0; i < failed.size(); ++i)
+				delegate_->OnBroadcastFailed(failed[i], m.get());
+			if (bus_failed)
+				delegate_->OnBusFailed(m.get());
+		}
+		return failed.empty() && !bus_failed;
+	}
+}
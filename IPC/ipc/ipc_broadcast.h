@@ -0,0 +1,85 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+#include "ipc/ipc_messager.h"
+
+#include <vector>
+
+namespace IPC
+{
+	class Endpoint;
+	class SharedBusPublisher;
+
+	// Sends one message to a group of endpoints. The message is built and
+	// serialized once by the caller; every member queues a reference to the
+	// same immutable buffer, so a broadcast costs one allocation whatever the
+	// size of the group. Members must not modify messages they send.
+	//
+	// Shared-memory readers are reached through the group's bus instead: the
+	// message is written once into the bus segment and every subscriber reads
+	// it from there. A METHOD_SHARED endpoint added as a member still copies
+	// it into its own one-to-one segment.
+	class BroadcastGroup : public Sender
+	{
+	public:
+		class Delegate {
+		public:
+			// Called on the sending thread, after the message has been handed to
+			// the other members, for each member that did not accept |message|.
+			// Members may be removed from the group here.
+			virtual void OnBroadcastFailed(Endpoint* member, const Message* message) = 0;
+
+			// Called likewise if the bus refused |message|.
+			virtual void OnBusFailed(const Message* message) {}
+
+		protected:
+			virtual ~Delegate() {}
+		};
+
+		explicit BroadcastGroup(Delegate* delegate = NULL);
+		~BroadcastGroup();
+
+		void AddMember(Endpoint* member);
+		// Returns once the sends still handing messages to |member| on other
+		// threads are done with it, so it may be deleted afterwards. Must not
+		// be called from a member's Send.
+		void RemoveMember(Endpoint* member);
+		size_t member_count() const;
+
+		// Publishes every broadcast on |bus| as well, once for all its
+		// subscribers. The bus must be open and outlive the group, or be
+		// replaced first; NULL stops publishing. Like RemoveMember, waits for
+		// the sends still using the previous bus.
+		void set_bus(SharedBusPublisher* bus);
+
+		// Hands |message| to every member and the bus. Takes ownership of
+		// |message| like Endpoint::Send. A member that is not connected does
+		// not hold up the others; it is reported to the delegate instead.
+		// Returns true if every member and the bus accepted the message.
+		virtual bool Send(Message* message) override;
+
+	private:
+		// The members as of one change. Sends take a reference and hand out
+		// the message without the lock; changes replace the whole list.
+		struct Members;
+
+		// Counts a send as started; its snapshot is whatever it read with
+		// the same lock held.
+		ipc_ull EnterSend();
+		void LeaveSend(ipc_ull ticket);
+		// Waits for the sends started before the last change to finish.
+		void WaitForSends();
+
+		Delegate* delegate_;
+
+		mutable Lock lock_;
+		ScopedPtr<Members> members_;
+		SharedBusPublisher* bus_;
+		// Tickets of the sends running outside |lock_|, and the next one.
+		std::vector<ipc_ull> sending_;
+		ipc_ull next_ticket_;
+
+		DISALLOW_COPY_AND_ASSIGN(BroadcastGroup);
+	};
+}
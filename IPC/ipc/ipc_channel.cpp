@@ -41,9 +41,16 @@ namespace IPC {
 		input_state_(this),
 		output_state_(this),
 		pipe_(INVALID_HANDLE_VALUE),
+		pending_write_count_(0),
 		waiting_connect_(true),
 		processing_incoming_(false),
 		client_secret_(0),
+		shutdown_acked_(false),
+		drain_queued_(0),
+		drain_written_(0),
+		drain_callback_(NULL),
+		drain_context_(NULL),
+		drain_timer_(0),
 		thread_(thread),
 		validate_client_(false) {
 		CreatePipe(channel_handle);
@@ -74,11 +81,11 @@ namespace IPC {
 			thread_->WaitForIOCompletion(INFINITE, this);
 		}
 
-		while (!output_queue_.empty()) {
-			Message* m = output_queue_.front();
+		while (!output_queue_.empty())
 			output_queue_.pop();
-			m->Release();
-		}
+		pending_write_count_ = 0;
+		DiscardQueued();
+		FinishDrain();
 	}
 
 	bool Channel::Send(Message* message) {
@@ -90,9 +97,9 @@ namespace IPC {
 #ifdef IPC_MESSAGE_LOG_ENABLED
 		Logging::GetInstance()->OnSendMessage(message, "");
 #endif
-		message->AddRef();
 		//message->TraceMessageBegin();
 		output_queue_.push(message);
+		MessageQueued();
 		// ensure waiting to write
 		if (!waiting_connect_) {
 			if (!output_state_.is_pending) {
@@ -104,6 +111,17 @@ namespace IPC {
 		return true;
 	}
 
+	bool Channel::SendBatch(ScopedPtr<Message>* messages, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			output_queue_.push(std::move(messages[i]));
+			MessageQueued();
+		}
+		// One write then takes the whole batch, as far as it fits.
+		if (!waiting_connect_ && !output_state_.is_pending)
+			return ProcessOutgoingMessages(NULL, 0);
+		return true;
+	}
+
 
 
 	Channel::ReadState Channel::ReadData(
@@ -169,6 +187,76 @@ namespace IPC {
 		listener()->OnConnected(claimed_pid);
 	}
 
+	void Channel::HandleInternalMessage(Message* msg) {
+		if (msg->type() == SHUTDOWN_MESSAGE_TYPE)
+			Send(new Message(MSG_ROUTING_NONE, SHUTDOWN_ACK_MESSAGE_TYPE,
+				Message::PRIORITY_NORMAL));
+		else if (msg->type() == SHUTDOWN_ACK_MESSAGE_TYPE) {
+			shutdown_acked_ = true;
+			FinishDrain();
+		}
+	}
+
+	bool Channel::BeginDrain() {
+		drain_queued_ = output_queue_.size();
+		drain_written_ = messages_written_;
+		shutdown_acked_ = false;
+		if (waiting_connect_ || pipe_ == INVALID_HANDLE_VALUE)
+			return false;
+		Send(new Message(MSG_ROUTING_NONE, SHUTDOWN_MESSAGE_TYPE,
+			Message::PRIORITY_NORMAL));
+		return true;
+	}
+
+	DrainResult Channel::DrainOutcome() const {
+		DrainResult result;
+		result.flushed = static_cast<size_t>((std::min)(
+			messages_written_ - drain_written_, static_cast<ipc_ull>(drain_queued_)));
+		result.dropped = drain_queued_ - result.flushed;
+		result.acknowledged = shutdown_acked_;
+		return result;
+	}
+
+	DrainResult Channel::Drain(ipc_ull deadline) {
+		if (!BeginDrain())
+			return DrainOutcome();
+
+		// The thread's other channels are serviced meanwhile, as the thread
+		// may be a pool worker shared with the peer. Tasks wait until the
+		// drain returns. A pipe error closes the channel and ends the wait.
+		while (!shutdown_acked_ && pipe_ != INVALID_HANDLE_VALUE) {
+			ipc_ull now = ::GetTickCount64();
+			if (now >= deadline)
+				break;
+			thread_->WaitForIOCompletion(static_cast<DWORD>(deadline - now), NULL);
+		}
+		return DrainOutcome();
+	}
+
+	void Channel::DrainAsync(ipc_ull deadline, DrainCallback callback, void* context) {
+		assert(!drain_callback_);
+		if (!BeginDrain()) {
+			callback(context, DrainOutcome());
+			return;
+		}
+		drain_callback_ = callback;
+		drain_context_ = context;
+		ipc_ull now = ::GetTickCount64();
+		drain_timer_ = thread_->PostDelayedTask(std::bind(&Channel::FinishDrain, this),
+			now < deadline ? static_cast<DWORD>(deadline - now) : 0);
+	}
+
+	void Channel::FinishDrain() {
+		if (!drain_callback_)
+			return;
+		DrainCallback callback = drain_callback_;
+		drain_callback_ = NULL;
+		// Harmless when the timer is what got here.
+		thread_->CancelTimer(drain_timer_);
+		drain_timer_ = 0;
+		callback(drain_context_, DrainOutcome());
+	}
+
 	bool Channel::DidEmptyInputBuffers() {
 		// We don't need to do anything here.
 		return true;
@@ -258,10 +346,9 @@ namespace IPC {
 		}
 
 		// Create the Hello message to be sent when Connect is called
-		Message* m = new Message(MSG_ROUTING_NONE,
+		ScopedPtr<Message> m(new Message(MSG_ROUTING_NONE,
 			HELLO_MESSAGE_TYPE,
-			IPC::Message::PRIORITY_NORMAL);
-		m->AddRef();
+			IPC::Message::PRIORITY_NORMAL));
 		// Don't send the secret to the untrusted process, and don't send a secret
 		// if the value is zero (for IPC backwards compatability).
 		ipc_i secret = validate_client_ ? 0 : client_secret_;
@@ -269,11 +356,11 @@ namespace IPC {
 			(secret && !m->WriteUInt32(secret))) {
 			CloseHandle(pipe_);
 			pipe_ = INVALID_HANDLE_VALUE;
-			m->Release();
 			return false;
 		}
 
-		output_queue_.push(m);
+		output_queue_.push(std::move(m));
+		MessageQueued();
 		return true;
 	}
 
@@ -361,11 +448,12 @@ namespace IPC {
 				//LOG(ERROR) << "pipe error: " << err;
 				return false;
 			}
-			// Message was sent.
-			assert(!output_queue_.empty());
-			Message* m = output_queue_.front();
-			output_queue_.pop();
-			m->Release();
+			// Messages were sent.
+			assert(output_queue_.size() >= pending_write_count_);
+			for (; pending_write_count_; --pending_write_count_) {
+				output_queue_.pop();
+				MessageWritten();
+			}
 		}
 
 		if (output_queue_.empty())
@@ -374,12 +462,32 @@ namespace IPC {
 		if (INVALID_HANDLE_VALUE == pipe_)
 			return false;
 
-		// Write to pipe...
-		Message* m = output_queue_.front();
+		// Write to pipe. Messages behind the first go out with it while
+		// they fit in kMaxCoalescedWrite; the pipe is a byte stream, so the
+		// reader splits them up as usual.
+		const Message* m = output_queue_.front().get();
 		assert(m->size() <= INT_MAX);
+		const void* data = m->data();
+		size_t size = m->size();
+		pending_write_count_ = 1;
+		while (pending_write_count_ < output_queue_.size() &&
+			size + output_queue_[pending_write_count_]->size() <= kMaxCoalescedWrite) {
+			size += output_queue_[pending_write_count_]->size();
+			++pending_write_count_;
+		}
+		if (pending_write_count_ > 1) {
+			write_buffer_.resize(size);
+			char* dest = &write_buffer_[0];
+			for (size_t i = 0; i < pending_write_count_; ++i) {
+				const Message* queued = output_queue_[i].get();
+				memcpy(dest, queued->data(), queued->size());
+				dest += queued->size();
+			}
+			data = &write_buffer_[0];
+		}
 		BOOL ok = WriteFile(pipe_,
-			m->data(),
-			static_cast<int>(m->size()),
+			data,
+			static_cast<int>(size),
 			&bytes_written,
 			&output_state_.context.overlapped);
 		if (!ok) {
@@ -447,6 +555,8 @@ namespace IPC {
 		else {
 			assert(context == &output_state_.context);
 			ok = ProcessOutgoingMessages(context, bytes_transfered);
+			if (ok)
+				RunWriteCallbacks();
 		}
 		if (!ok && INVALID_HANDLE_VALUE != pipe_) {
 			// We don't want to re-enter Close().
@@ -62,16 +62,24 @@ namespace IPC
 	{
 	public:
 		enum {
-			HELLO_MESSAGE_TYPE = kushortmax  // Maximum value of message type (unsigned short),
+			HELLO_MESSAGE_TYPE = kushortmax, // Maximum value of message type (unsigned short),
 											 // to avoid conflicting with normal
 											 // message types, which are enumeration
 											 // constants starting from 0.
+			// Queued by Drain behind the last message. The peer answers with
+			// SHUTDOWN_ACK_MESSAGE_TYPE once it has read everything before it.
+			SHUTDOWN_MESSAGE_TYPE = kushortmax - 1,
+			SHUTDOWN_ACK_MESSAGE_TYPE = kushortmax - 2
 		};
 
 		// The maximum message size in bytes. Attempting to receive a message of this
 		// size or bigger results in a channel error.
 		static const size_t kMaximumMessageSize = 128 * 1024 * 1024;
 
+		// Queued messages are copied together and written with one WriteFile
+		// up to this many bytes.
+		static const size_t kMaxCoalescedWrite = 64 * 1024;
+
 		// Mirror methods of Channel, see ipc_channel.h for description.
 		Channel(const IPC::ChannelHandle &channel_handle,
 			Receiver* listener, Thread* thread);
@@ -79,6 +87,15 @@ namespace IPC
 		virtual bool Connect();
 		virtual void Close();
 		virtual bool Send(Message* message) override;
+		virtual bool SendBatch(ScopedPtr<Message>* messages, size_t count) override;
+		virtual DrainResult Drain(ipc_ull deadline) override;
+
+		typedef void(*DrainCallback)(void* context, const DrainResult& result);
+		// Drain without blocking the thread: returns at once and calls
+		// |callback| when the peer acknowledges, the pipe closes or
+		// |deadline| passes, at the latest from Close. Other channels and
+		// tasks on the thread keep running meanwhile.
+		void DrainAsync(ipc_ull deadline, DrainCallback callback, void* context);
 
 	private:
 		// Returns true if a named server channel is initialized on the given channel
@@ -101,11 +118,19 @@ namespace IPC
 		virtual bool WillDispatchInputMessage(Message* msg) override;
 		bool DidEmptyInputBuffers() override;
 		virtual void HandleHelloMessage(Message* msg) override;
+		virtual void HandleInternalMessage(Message* msg) override;
 
 		static const std::wstring PipeName(const std::string& channel_id,
 			ipc_i* secret);
 		bool CreatePipe(const IPC::ChannelHandle &channel_handle);
 
+		// Queues the shutdown message and notes how much was queued before
+		// it. False if there is no connection to drain.
+		bool BeginDrain();
+		DrainResult DrainOutcome() const;
+		// Ends a DrainAsync, if one is running.
+		void FinishDrain();
+
 		bool ProcessConnection();
 		bool ProcessOutgoingMessages(Thread::IOContext* context,
 			DWORD bytes_written);
@@ -129,7 +154,12 @@ namespace IPC
 		HANDLE pipe_;
 
 		// Messages to be sent are queued here.
-		std::queue<Message*> output_queue_;
+		FifoQueue<ScopedPtr<Message> > output_queue_;
+		// Messages at the front of |output_queue_| covered by the write in
+		// flight.
+		size_t pending_write_count_;
+		// Holds the copies of a coalesced write until it completes.
+		std::vector<char> write_buffer_;
 
 		// In server-mode, we have to wait for the client to connect before we
 		// can begin reading.  We make use of the input_state_ when performing
@@ -150,6 +180,16 @@ namespace IPC
 		// compatability with existing clients that don't validate the channel.)
 		ipc_i client_secret_;
 
+		// Set when the peer acknowledges our shutdown message.
+		bool shutdown_acked_;
+
+		// The drain in progress: what was queued and written when it began.
+		size_t drain_queued_;
+		ipc_ull drain_written_;
+		DrainCallback drain_callback_;
+		void* drain_context_;
+		basic_thread::TimerId drain_timer_;
+
 		Thread* thread_;
 
 		DISALLOW_COPY_AND_ASSIGN(Channel);
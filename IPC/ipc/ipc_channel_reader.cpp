@@ -43,6 +43,12 @@ bool ChannelReader::IsHelloMessage(Message* m) const {
          m->type() == Channel::HELLO_MESSAGE_TYPE;
 }
 
+bool ChannelReader::IsInternalMessage(Message* m) const {
+  return m->routing_id() == MSG_ROUTING_NONE &&
+         (m->type() == Channel::SHUTDOWN_MESSAGE_TYPE ||
+          m->type() == Channel::SHUTDOWN_ACK_MESSAGE_TYPE);
+}
+
 bool ChannelReader::DispatchInputData(const char* input_data,
                                       int input_data_len) {
   const char* p;
@@ -69,9 +75,8 @@ bool ChannelReader::DispatchInputData(const char* input_data,
     const char* message_tail = Message::FindNext(p, end);
     if (message_tail) {
       int len = static_cast<int>(message_tail - p);
-      Message* m = new Message(p, len);
-	  m->AddRef();
-      if (!WillDispatchInputMessage(m))
+      ScopedPtr<Message> m(new Message(p, len));
+      if (!WillDispatchInputMessage(m.get()))
         return false;
 
 #ifdef IPC_MESSAGE_LOG_ENABLED
@@ -85,10 +90,12 @@ bool ChannelReader::DispatchInputData(const char* input_data,
       //             "line", IPC_MESSAGE_ID_LINE(m.type()));
 #endif
       //m.TraceMessageEnd();
-      if (IsHelloMessage(m))
-        HandleHelloMessage(m);
+      if (IsHelloMessage(m.get()))
+        HandleHelloMessage(m.get());
+      else if (IsInternalMessage(m.get()))
+        HandleInternalMessage(m.get());
       else
-        listener_->OnMessageReceived(m);
+        listener_->OnMessageReceived(m.get());
       p = message_tail;
     } else {
       // Last message is partial.
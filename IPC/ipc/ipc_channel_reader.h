@@ -49,6 +49,10 @@ class ChannelReader {
   // set-up.
   bool IsHelloMessage(Message* m) const;
 
+  // Returns true for the channel's own messages other than hello, which are
+  // handed to HandleInternalMessage instead of the listener.
+  bool IsInternalMessage(Message* m) const;
+
  protected:
   enum ReadState { READ_SUCCEEDED, READ_FAILED, READ_PENDING };
 
@@ -82,6 +86,9 @@ class ChannelReader {
   // Handles the first message sent over the pipe which contains setup info.
   virtual void HandleHelloMessage(Message* msg) = 0;
 
+  // Handles a message for which IsInternalMessage is true.
+  virtual void HandleInternalMessage(Message* msg) = 0;
+
  private:
   // Takes the given data received from the IPC channel and dispatches any
   // fully completed messages.
@@ -0,0 +1,170 @@
+#include "ipc/ipc_checksum.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define IPC_CRC32C_X86 1
+#elif defined(_M_ARM64)
+#include <intrin.h>
+#define IPC_CRC32C_ARM64 1
+#endif
+
+namespace {
+
+	// Reflected Castagnoli polynomial.
+	const IPC::ipc_ui kCrc32cPoly = 0x82F63B78;
+
+	struct Crc32cTables {
+		IPC::ipc_ui t[8][256];
+	};
+
+	Crc32cTables BuildTables()
+	{
+		Crc32cTables tables;
+		for (IPC::ipc_ui i = 0; i < 256; ++i)
+		{
+			IPC::ipc_ui crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+				crc = (crc & 1) ? (crc >> 1) ^ kCrc32cPoly : crc >> 1;
+			tables.t[0][i] = crc;
+		}
+		for (IPC::ipc_ui i = 0; i < 256; ++i)
+		{
+			IPC::ipc_ui crc = tables.t[0][i];
+			for (int k = 1; k < 8; ++k)
+			{
+				crc = tables.t[0][crc & 0xFF] ^ (crc >> 8);
+				tables.t[k][i] = crc;
+			}
+		}
+		return tables;
+	}
+
+	const Crc32cTables& Tables()
+	{
+		static const Crc32cTables tables = BuildTables();
+		return tables;
+	}
+
+	IPC::ipc_ui Crc32cSoftware(const unsigned char* p, size_t length, IPC::ipc_ui crc)
+	{
+		const Crc32cTables& tables = Tables();
+		while (length && (reinterpret_cast<size_t>(p) & 7))
+		{
+			crc = tables.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+			--length;
+		}
+		while (length >= 8)
+		{
+			IPC::ipc_ui lo;
+			IPC::ipc_ui hi;
+			memcpy(&lo, p, 4);
+			memcpy(&hi, p + 4, 4);
+			lo ^= crc;
+			crc = tables.t[7][lo & 0xFF] ^
+				tables.t[6][(lo >> 8) & 0xFF] ^
+				tables.t[5][(lo >> 16) & 0xFF] ^
+				tables.t[4][lo >> 24] ^
+				tables.t[3][hi & 0xFF] ^
+				tables.t[2][(hi >> 8) & 0xFF] ^
+				tables.t[1][(hi >> 16) & 0xFF] ^
+				tables.t[0][hi >> 24];
+			p += 8;
+			length -= 8;
+		}
+		while (length--)
+			crc = tables.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		return crc;
+	}
+
+#if defined(IPC_CRC32C_X86)
+	bool DetectHardware()
+	{
+		int info[4] = { 0 };
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;  // SSE4.2
+	}
+
+	IPC::ipc_ui Crc32cHardware(const unsigned char* p, size_t length, IPC::ipc_ui crc)
+	{
+		while (length && (reinterpret_cast<size_t>(p) & 7))
+		{
+			crc = _mm_crc32_u8(crc, *p++);
+			--length;
+		}
+#if defined(_M_X64)
+		unsigned long long crc64 = crc;
+		while (length >= 8)
+		{
+			crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const unsigned long long*>(p));
+			p += 8;
+			length -= 8;
+		}
+		crc = static_cast<IPC::ipc_ui>(crc64);
+#else
+		while (length >= 4)
+		{
+			crc = _mm_crc32_u32(crc, *reinterpret_cast<const unsigned int*>(p));
+			p += 4;
+			length -= 4;
+		}
+#endif
+		while (length--)
+			crc = _mm_crc32_u8(crc, *p++);
+		return crc;
+	}
+#elif defined(IPC_CRC32C_ARM64)
+	bool DetectHardware()
+	{
+		return ::IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != FALSE;
+	}
+
+	IPC::ipc_ui Crc32cHardware(const unsigned char* p, size_t length, IPC::ipc_ui crc)
+	{
+		while (length && (reinterpret_cast<size_t>(p) & 7))
+		{
+			crc = __crc32cb(crc, *p++);
+			--length;
+		}
+		while (length >= 8)
+		{
+			crc = __crc32cd(crc, *reinterpret_cast<const unsigned long long*>(p));
+			p += 8;
+			length -= 8;
+		}
+		while (length--)
+			crc = __crc32cb(crc, *p++);
+		return crc;
+	}
+#else
+	bool DetectHardware()
+	{
+		return false;
+	}
+
+	IPC::ipc_ui Crc32cHardware(const unsigned char* p, size_t length, IPC::ipc_ui crc)
+	{
+		return Crc32cSoftware(p, length, crc);
+	}
+#endif
+
+	const bool g_crc32c_hardware = DetectHardware();
+
+}  // namespace
+
+namespace IPC
+{
+	ipc_ui Crc32c(const void* data, size_t length, ipc_ui crc)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		crc = ~crc;
+		crc = g_crc32c_hardware ? Crc32cHardware(p, length, crc)
+			: Crc32cSoftware(p, length, crc);
+		return ~crc;
+	}
+
+	bool Crc32cIsHardwareAccelerated()
+	{
+		return g_crc32c_hardware;
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+
+namespace IPC
+{
+	// Computes the CRC32C (Castagnoli) of |data|, continuing from |crc| so a
+	// checksum can be built over several disjoint ranges. The SSE4.2 (x86) or
+	// ARMv8 CRC instructions are used when the CPU has them; otherwise a
+	// slice-by-8 table implementation is used.
+	ipc_ui Crc32c(const void* data, size_t length, ipc_ui crc = 0);
+
+	// Returns true if Crc32c() runs on the hardware CRC instructions.
+	bool Crc32cIsHardwareAccelerated();
+}
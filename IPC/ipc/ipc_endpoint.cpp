@@ -1,20 +1,65 @@
 #include "ipc/ipc_endpoint.h"
 #include "ipc/ipc_thread.h"
+#include "ipc/ipc_io_thread_pool.h"
+#include "ipc/ipc_executor.h"
+#include "ipc/ipc_poll_queue.h"
 #include "ipc/ipc_msg.h"
 #include "ipc/ipc_sharedmem.h"
 #include "ipc/ipc_channel.h"
+#include "ipc/ipc_reliable.h"
+#include <algorithm>
 #include <cassert>
 
 namespace IPC
 {
+	// Shared by Shutdown and the drain task, which may still run after
+	// Shutdown has stopped waiting for it.
+	struct Endpoint::DrainState {
+		explicit DrainState(Endpoint* e)
+			: refs(0), endpoint(e), done_event(::CreateEvent(NULL, TRUE, FALSE, NULL))
+		{
+			DrainResult none = { 0, 0, false };
+			result = none;
+		}
+		~DrainState() { ::CloseHandle(done_event); }
+		void AddRef() const { ::InterlockedIncrement(&refs); }
+		void Release() const
+		{
+			if (!::InterlockedDecrement(&refs))
+				delete this;
+		}
+
+		mutable volatile long refs;
+		Endpoint* endpoint;
+		DrainResult result;
+		HANDLE done_event;
+	};
+
+	struct Endpoint::SyncWaiter {
+		Endpoint* endpoint;
+		PendingCall call;
+		// Auto-reset; set for the reply and for each message in |incoming|.
+		HANDLE event;
+		bool done;
+		ScopedPtr<Message> reply;
+		// should_unblock() messages received while blocked.
+		FifoQueue<ScopedPtr<Message> > incoming;
+	};
 
-	Endpoint::Endpoint(const ipc_tstring& name, Receiver* receiver, EndpointMethod method, bool start_now)
+	Endpoint::Endpoint(const ipc_tstring& name, Receiver* receiver, EndpointMethod method, bool start_now,
+		const Options& options)
 		: name_(name)
 		, iterpc_Impl_(NULL)
 		, thread_(NULL)
 		, receiver_(receiver)
 		, method_(method)
-		, is_connected_(false)
+		, options_(options)
+		, is_connected_(0)
+		, shutting_down_(0)
+		, direct_(NULL)
+		, link_(NULL)
+		, reconnect_delay_(options.reconnect_delay_ms)
+		, reconnect_timer_(0)
 	{
 		if (start_now)
 			Start();
@@ -24,11 +69,24 @@ namespace IPC
 	Endpoint::~Endpoint()
 	{
 		SetConnected(false);
+		direct_ = NULL;
+		if (!thread_)
+			return;
 		HANDLE wait_event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
 		thread_->PostTask(std::bind(&Endpoint::Close, this, wait_event));
 		DWORD ret = ::WaitForSingleObject(wait_event, 2000);
 		assert(ret == WAIT_OBJECT_0);
 		CloseHandle(wait_event);
+		// Close has cancelled the link's timers on the IO thread.
+		delete link_;
+		link_ = NULL;
+		if (UsesPool())
+		{
+			// The channel was closed on the worker, which keeps serving others.
+			options_.io_thread_pool->Release(static_cast<Thread*>(thread_));
+			thread_ = NULL;
+			return;
+		}
 		thread_->Stop();
 		thread_->Wait(2000);
 		if (iterpc_Impl_) 
@@ -44,7 +102,11 @@ namespace IPC
 
 	void Endpoint::Start()
 	{
-		CreateInstance(NULL, &thread_);
+		// A reconnect after OnError keeps the thread the channel ran on.
+		if (!thread_)
+			CreateInstance(NULL, &thread_);
+		if (!link_ && options_.reliable && method_ == METHOD_PIPE)
+			link_ = new ReliableLink(thread_, options_.max_unacked);
 		if (iterpc_Impl_ == NULL)
 			thread_->PostTask(std::bind(&Endpoint::Create, this));
 	}
@@ -52,15 +114,84 @@ namespace IPC
 
 	bool Endpoint::IsConnected() const
 	{
-		AutoLock lock(lock_);
-		return is_connected_;
+		return is_connected_ != 0;
+	}
+
+
+	bool Endpoint::IsShuttingDown() const
+	{
+		return shutting_down_ != 0;
+	}
+
+	DrainResult Endpoint::Shutdown(DWORD timeout_ms)
+	{
+		InterlockedExchange(&shutting_down_, 1);
+		DrainResult result = { 0, 0, false };
+		if (!thread_)
+			return result;
+		// Sends posted or enqueued before this point are taken first, so
+		// they are counted.
+		ipc_ull deadline = ::GetTickCount64() + timeout_ms;
+		if (thread_->RunsTasksOnCurrentThread())
+		{
+			// E.g. a receiver callback; the drain task could not run while
+			// this waits for it.
+			Drain(deadline, &result);
+			return result;
+		}
+		ScopedPtr<DrainState> state(new DrainState(this));
+		thread_->PostTask(std::bind(&Endpoint::OnDrain, this, deadline, state));
+		// An IO thread stuck in a slow handler does not hold up the caller
+		// past the deadline; the drain then reports nothing.
+		DWORD wait = timeout_ms >= INFINITE - kDrainSlack ? INFINITE : timeout_ms + kDrainSlack;
+		if (::WaitForSingleObject(state->done_event, wait) == WAIT_OBJECT_0)
+			result = state->result;
+		return result;
 	}
 
+	void Endpoint::OnDrain(ipc_ull deadline, const ScopedPtr<DrainState>& state)
+	{
+		if (UsesPool() && iterpc_Impl_)
+		{
+			// The worker serves other channels, perhaps the peer's, so it
+			// is not held up until the peer answers. The channel holds a
+			// reference to |state| until it calls back.
+			state->AddRef();
+			static_cast<Channel*>(iterpc_Impl_)->DrainAsync(deadline,
+				&Endpoint::OnChannelDrained, state.get());
+			return;
+		}
+		Drain(deadline, &state->result);
+		::SetEvent(state->done_event);
+	}
+
+	// static
+	void Endpoint::OnChannelDrained(void* context, const DrainResult& result)
+	{
+		DrainState* state = static_cast<DrainState*>(context);
+		state->result = result;
+		state->endpoint->AddLinkBacklog(&state->result);
+		::SetEvent(state->done_event);
+		state->Release();
+	}
+
+	void Endpoint::Drain(ipc_ull deadline, DrainResult* result)
+	{
+		if (iterpc_Impl_)
+			*result = iterpc_Impl_->Drain(deadline);
+		AddLinkBacklog(result);
+	}
+
+	void Endpoint::AddLinkBacklog(DrainResult* result) const
+	{
+		// What the link holds for a peer that has not resumed never left.
+		if (link_ && !link_->resumed())
+			result->dropped += link_->unacked();
+	}
 
 	void Endpoint::SetConnected(bool c)
 	{
-		AutoLock lock(lock_);
-		is_connected_ = c;
+		InterlockedExchange(&is_connected_, c ? 1 : 0);
 	}
 
 	void Endpoint::CreateInstance(BasicIterPC ** iterpc, basic_thread ** thread)
@@ -68,20 +199,32 @@ namespace IPC
 		switch (method_)
 		{
 		case METHOD_PIPE:
-			if (thread) { 
+			if (thread && UsesPool()) {
+				*thread = options_.io_thread_pool->Acquire();
+			}
+			else if (thread) { 
 				*thread = new Thread;
-				if (*thread)
+				if (*thread) {
+					(*thread)->SetOptions(IOThreadOptions());
 					(*thread)->Start();
+				}
 			}
 			if (iterpc) *iterpc = new Channel(IPC::WideToASCII(name_), this, static_cast<Thread*>(thread_));
 			break;
 		case METHOD_SHARED:
 			if (thread) {
-				*thread = new ThreadShared;
-				if (*thread)
+				*thread = new ThreadShared(options_.single_loop);
+				if (*thread) {
+					(*thread)->SetOptions(IOThreadOptions());
 					(*thread)->Start();
+				}
+			}
+			if (iterpc) {
+				SharedMem* shared = new SharedMem(name_, this, static_cast<ThreadShared*>(thread_),
+					PreferredNumaNode());
+				shared->set_checksum(options_.checksum);
+				*iterpc = shared;
 			}
-			if (iterpc) *iterpc = new SharedMem(name_, this, static_cast<ThreadShared*>(thread_));
 			break;
 		default:
 			break;
@@ -94,44 +237,412 @@ namespace IPC
 			return;
 
 		CreateInstance(&iterpc_Impl_, NULL);
-		iterpc_Impl_->Connect();
+		// Shared memory stays until the destructor, so other threads may hold
+		// on to it. A pipe channel is replaced on the IO thread after an
+		// error, so sends to it keep going through that thread.
+		if (method_ == METHOD_SHARED)
+			InterlockedExchangePointer(reinterpret_cast<void* volatile*>(&direct_), iterpc_Impl_);
+		if (!iterpc_Impl_->Connect() && link_)
+		{
+			// No pipe to open yet; the link keeps what is sent meanwhile.
+			BasicIterPC* pIpc = iterpc_Impl_;
+			iterpc_Impl_ = NULL;
+			delete pIpc;
+			ScheduleReconnect();
+		}
 	}
 
 	bool Endpoint::Send(Message* message)
 	{
 		ScopedPtr<Message> m(message);
-		if (iterpc_Impl_ == NULL || !IsConnected()) {
+		if (link_)
+		{
+			// Accepted while the pipe is down; the link sends it later.
+			if (IsShuttingDown() || !link_->Reserve(1))
+				return false;
+			thread_->PostTask(std::bind(&Endpoint::OnSendMessage, this, std::move(m)));
+			return true;
+		}
+		if (iterpc_Impl_ == NULL || !IsConnected() || IsShuttingDown()) {
 			return false;
 		}
+		if (BasicIterPC* direct = direct_)
+			return direct->Enqueue(m);
 		if(thread_) 
-			thread_->PostTask(std::bind(&Endpoint::OnSendMessage, this, m));
+			thread_->PostTask(std::bind(&Endpoint::OnSendMessage, this, std::move(m)));
 		return true;
 	}
 
 
-	void Endpoint::OnSendMessage(ScopedPtr<Message> message)
+	void Endpoint::OnSendMessage(const ScopedPtr<Message>& message)
 	{
+		if (link_)
+		{
+			link_->Send(message);
+			return;
+		}
 		if (iterpc_Impl_ == NULL)
 			return;
 
 		iterpc_Impl_->Send(message.get());
 	}
 
+	bool Endpoint::PostBatch(std::vector<ScopedPtr<Message> >& batch)
+	{
+		if (link_)
+		{
+			if (IsShuttingDown() || !link_->Reserve(batch.size()))
+				return false;
+			if (!batch.empty())
+				thread_->PostTask(std::bind(&Endpoint::OnSendBatch, this, std::move(batch)));
+			return true;
+		}
+		if (iterpc_Impl_ == NULL || !IsConnected() || IsShuttingDown() || !thread_) {
+			return false;
+		}
+		if (BasicIterPC* direct = direct_)
+		{
+			// The transport wakes its thread once for the whole run.
+			for (size_t i = 0; i < batch.size(); ++i)
+			{
+				if (!direct->Enqueue(batch[i]))
+					return false;
+			}
+			return true;
+		}
+		if (!batch.empty())
+			thread_->PostTask(std::bind(&Endpoint::OnSendBatch, this, std::move(batch)));
+		return true;
+	}
+
+	void Endpoint::OnSendBatch(std::vector<ScopedPtr<Message> >& batch)
+	{
+		if (link_)
+		{
+			link_->SendBatch(batch.data(), batch.size());
+			return;
+		}
+		if (iterpc_Impl_ == NULL)
+			return;
+
+		iterpc_Impl_->SendBatch(batch.data(), batch.size());
+	}
+
+	bool Endpoint::SendAndNotify(Message* message, BasicIterPC::WriteCallback callback, void* context)
+	{
+		ScopedPtr<Message> m(message);
+		if (link_)
+		{
+			if (IsShuttingDown() || !link_->Reserve(1))
+				return false;
+		}
+		else if (iterpc_Impl_ == NULL || !IsConnected() || IsShuttingDown() || !thread_) {
+			return false;
+		}
+		if (BasicIterPC* direct = direct_)
+		{
+			if (!direct->Enqueue(m))
+				return false;
+			// Posted after the message, so the IO thread takes the message
+			// over before it starts waiting for it.
+			thread_->PostTask(std::bind(&Endpoint::OnNotifyWhenWritten, this, callback, context));
+			return true;
+		}
+		thread_->PostTask(std::bind(&Endpoint::OnSendAndNotify, this, std::move(m),
+			callback, context));
+		return true;
+	}
+
+	void Endpoint::OnNotifyWhenWritten(BasicIterPC::WriteCallback callback, void* context)
+	{
+		if (iterpc_Impl_ == NULL)
+		{
+			callback(context, false);
+			return;
+		}
+		iterpc_Impl_->NotifyWhenWritten(callback, context);
+	}
+
+	void Endpoint::OnSendAndNotify(const ScopedPtr<Message>& message,
+		BasicIterPC::WriteCallback callback, void* context)
+	{
+		if (link_)
+		{
+			if (link_->Send(message) && iterpc_Impl_)
+				iterpc_Impl_->NotifyWhenWritten(callback, context);
+			else
+				callback(context, false);
+			return;
+		}
+		if (iterpc_Impl_ == NULL || !iterpc_Impl_->Send(message.get()))
+		{
+			callback(context, false);
+			return;
+		}
+		iterpc_Impl_->NotifyWhenWritten(callback, context);
+	}
+
+	bool Endpoint::StartCall(Message* message, PendingCall* call, DWORD timeout_ms)
+	{
+		ScopedPtr<Message> m(message);
+		// The timer is armed as the call goes in, so the table is locked once
+		// to insert it and once to take it out.
+		CallExpiry expiry = { this, timeout_ms };
+		bool inserted = timeout_ms != INFINITE && thread_ ?
+			calls_.Insert(call, &Endpoint::ArmCallTimer, &expiry) : calls_.Insert(call);
+		if (!inserted)
+			return false;
+		unsigned int request_id = call->request_id;
+		m->set_sync();
+		m->set_request_id(request_id);
+		if (Send(m.get()))
+			return true;
+		// If a disconnect failed the call meanwhile, it has been called back.
+		PendingCall* taken = calls_.Take(request_id);
+		if (!taken)
+			return true;
+		CancelCallTimer(taken);
+		return false;
+	}
+
+	namespace {
+
+		// A PendingCall owned by the table's callback for CallAsync.
+		struct CallbackCall {
+			PendingCall call;
+			Endpoint::ReplyCallback callback;
+
+			static void Complete(PendingCall* call, Message* reply)
+			{
+				CallbackCall* self = static_cast<CallbackCall*>(call->context);
+				self->callback(reply);
+				delete self;
+			}
+		};
+
+	}  // namespace
+
+	bool Endpoint::CallAsync(Message* message, ReplyCallback callback, DWORD timeout_ms)
+	{
+		CallbackCall* pending = new CallbackCall;
+		pending->call.complete = &CallbackCall::Complete;
+		pending->call.context = pending;
+		pending->callback = std::move(callback);
+		if (StartCall(message, &pending->call, timeout_ms))
+			return true;
+		delete pending;
+		return false;
+	}
+
+	ipc_ull Endpoint::ArmCallTimer(void* context, unsigned int request_id)
+	{
+		CallExpiry* expiry = static_cast<CallExpiry*>(context);
+		return expiry->endpoint->thread_->PostDelayedTask(
+			std::bind(&Endpoint::ExpireCall, expiry->endpoint, request_id), expiry->timeout_ms);
+	}
+
+	void Endpoint::ExpireCall(unsigned int request_id)
+	{
+		// The timer has fired, so there is nothing to cancel.
+		if (PendingCall* call = calls_.Take(request_id))
+			call->complete(call, NULL);
+	}
+
+	void Endpoint::CancelCallTimer(PendingCall* call)
+	{
+		// Expiry tasks hold the endpoint, so none may outlive it; see Close.
+		if (call->timer && thread_)
+			thread_->CancelTimer(call->timer);
+		call->timer = 0;
+	}
+
+	bool Endpoint::SendSync(Message* message, DWORD timeout_ms, ScopedPtr<Message>* reply)
+	{
+		ScopedPtr<Message> m(message);
+		if (thread_ && thread_->RunsOnCurrentThread())
+			return false;
+
+		SyncWaiter waiter;
+		waiter.endpoint = this;
+		waiter.call.complete = &Endpoint::OnSyncReply;
+		waiter.call.context = &waiter;
+		waiter.event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+		waiter.done = false;
+		{
+			AutoLock lock(sync_lock_);
+			blocked_callers_.push_back(&waiter);
+		}
+
+		m->set_unblock(true);
+		bool sent = StartCall(m.get(), &waiter.call);
+		ipc_ull deadline = timeout_ms == INFINITE ?
+			static_cast<ipc_ull>(-1) : ::GetTickCount64() + timeout_ms;
+		while (sent)
+		{
+			ScopedPtr<Message> next;
+			bool done;
+			{
+				AutoLock lock(sync_lock_);
+				done = waiter.done;
+				if (!waiter.incoming.empty())
+				{
+					next = std::move(waiter.incoming.front());
+					waiter.incoming.pop();
+				}
+			}
+			if (next.get())
+			{
+				DispatchToReceiver(next.get());
+				continue;
+			}
+			if (done)
+				break;
+			ipc_ull now = ::GetTickCount64();
+			if (now >= deadline)
+			{
+				// Once out of the table the call can no longer complete. If
+				// the reply got there first, wait for it to be handed over.
+				if (calls_.Take(waiter.call.request_id))
+					break;
+				deadline = static_cast<ipc_ull>(-1);
+				continue;
+			}
+			::WaitForSingleObject(waiter.event, deadline == static_cast<ipc_ull>(-1) ?
+				INFINITE : static_cast<DWORD>(deadline - now));
+		}
+
+		FifoQueue<ScopedPtr<Message> > left;
+		{
+			AutoLock lock(sync_lock_);
+			blocked_callers_.erase(std::find(blocked_callers_.begin(),
+				blocked_callers_.end(), &waiter));
+			while (!waiter.incoming.empty())
+			{
+				left.push(std::move(waiter.incoming.front()));
+				waiter.incoming.pop();
+			}
+		}
+		// Messages handed over while giving up still belong to this thread.
+		while (!left.empty())
+		{
+			DispatchToReceiver(left.front().get());
+			left.pop();
+		}
+		CloseHandle(waiter.event);
+
+		bool ok = waiter.done && waiter.reply.get() && !waiter.reply->is_reply_error();
+		if (ok && reply)
+			*reply = waiter.reply;
+		return ok;
+	}
+
+	void Endpoint::OnSyncReply(PendingCall* call, Message* reply)
+	{
+		SyncWaiter* waiter = static_cast<SyncWaiter*>(call->context);
+		// The reply may point into the transport's buffer.
+		ScopedPtr<Message> copy(reply ? new Message(*reply) : NULL);
+		// SendSync reads the result under the same lock, so |waiter| stays
+		// alive until this returns.
+		AutoLock lock(waiter->endpoint->sync_lock_);
+		waiter->reply = std::move(copy);
+		waiter->done = true;
+		::SetEvent(waiter->event);
+	}
+
+	bool Endpoint::DeliverToBlockedCaller(Message* message)
+	{
+		AutoLock lock(sync_lock_);
+		if (blocked_callers_.empty())
+			return false;
+		SyncWaiter* waiter = blocked_callers_.back();
+		waiter->incoming.push(ScopedPtr<Message>(new Message(*message)));
+		::SetEvent(waiter->event);
+		return true;
+	}
+
+	bool Endpoint::DispatchToReceiver(Message* message)
+	{
+		bool handled = receiver_->OnMessageReceived(message);
+		if (!handled)
+			Message::ReplyUnhandled(this, message);
+		return handled;
+	}
+
+	SendOperation Endpoint::SendAsync(Message* message, basic_thread* resume_on)
+	{
+		return SendOperation(this, message, resume_on);
+	}
+
+	CallOperation Endpoint::Call(Message* message, basic_thread* resume_on, DWORD timeout_ms)
+	{
+		return CallOperation(this, message, resume_on, timeout_ms);
+	}
+
+	void Endpoint::FailPendingCalls()
+	{
+		PendingCall* call = calls_.TakeAll();
+		while (call)
+		{
+			PendingCall* next = call->next;
+			CancelCallTimer(call);
+			call->complete(call, NULL);
+			call = next;
+		}
+	}
+
 
 	bool Endpoint::OnMessageReceived(Message* message)
 	{
-		return receiver_->OnMessageReceived(message);
+		// The link's own messages stop here; the others count towards its
+		// acknowledgements.
+		if (link_ && link_->OnMessageReceived(message))
+			return true;
+		// Replies go to the call waiting for them, not to the receiver. One
+		// nobody waits for any more is dropped.
+		if (message->is_reply())
+		{
+			if (PendingCall* call = calls_.Take(message->request_id()))
+			{
+				CancelCallTimer(call);
+				call->complete(call, message);
+			}
+			return true;
+		}
+		if (message->should_unblock() && DeliverToBlockedCaller(message))
+			return true;
+		if (options_.poll_queue)
+		{
+			options_.poll_queue->PostMessageReceived(receiver_, message, this);
+			return true;
+		}
+		if (options_.executor)
+		{
+			options_.executor->Dispatch(receiver_, message, this);
+			return true;
+		}
+		return DispatchToReceiver(message);
 	}
 
 	void Endpoint::OnConnected(ipc_i peer_pid)
 	{
 		SetConnected(true);
-		receiver_->OnConnected(peer_pid);
+		if (link_)
+		{
+			reconnect_delay_ = options_.reconnect_delay_ms;
+			link_->Attach(iterpc_Impl_);
+		}
+		if (options_.poll_queue)
+			options_.poll_queue->PostConnected(receiver_, peer_pid);
+		else
+			receiver_->OnConnected(peer_pid);
 	}
 
 	void Endpoint::OnError()
 	{
-		if (method_ == METHOD_PIPE)
+		// A pipe that breaks while draining is left for the destructor to
+		// delete, since Drain is still on the stack, and is not reconnected.
+		bool reconnect = method_ == METHOD_PIPE && !IsShuttingDown();
+		if (reconnect)
 		{
 			//Channel::~() Error close
 			BasicIterPC* pIpc = iterpc_Impl_;
@@ -139,13 +650,41 @@ namespace IPC
 			delete pIpc;
 		}
 		SetConnected(false);
-		receiver_->OnError();
-		if (method_ == METHOD_PIPE)
+		// Reliable calls are answered after the reconnect, or time out.
+		if (link_)
+			link_->Detach();
+		else
+			FailPendingCalls();
+		if (options_.poll_queue)
+			options_.poll_queue->PostError(receiver_);
+		else
+			receiver_->OnError();
+		if (reconnect)
 		{
-			Start();
+			if (link_)
+				ScheduleReconnect();
+			else
+				Start();
 		}
 	}
 
+	void Endpoint::ScheduleReconnect()
+	{
+		if (reconnect_timer_ || IsShuttingDown() || !thread_)
+			return;
+		reconnect_timer_ = thread_->PostDelayedTask(std::bind(&Endpoint::Reconnect, this),
+			reconnect_delay_);
+		DWORD max_delay = options_.max_reconnect_delay_ms;
+		reconnect_delay_ = reconnect_delay_ > max_delay / 2 ? max_delay : reconnect_delay_ * 2;
+	}
+
+	void Endpoint::Reconnect()
+	{
+		reconnect_timer_ = 0;
+		if (!IsShuttingDown())
+			Create();
+	}
+
 	void Endpoint::Close(HANDLE wait_event)
 	{
 		if(method_ == METHOD_PIPE)
@@ -155,9 +694,50 @@ namespace IPC
 			iterpc_Impl_ = NULL;
 			delete pIpc;
 		}
+		if (reconnect_timer_)
+			thread_->CancelTimer(reconnect_timer_);
+		reconnect_timer_ = 0;
+		if (link_)
+			link_->Detach();
+		// Also cancels the expiry tasks, which must not run once the
+		// endpoint is gone.
+		FailPendingCalls();
 		SetEvent(wait_event);
 	}
 
+	bool Endpoint::UsesPool() const
+	{
+		return method_ == METHOD_PIPE && options_.io_thread_pool != NULL;
+	}
+
+	ThreadOptions Endpoint::IOThreadOptions() const
+	{
+		ThreadOptions options = options_.io_thread;
+		if (options.name.empty())
+			options.name = method_ == METHOD_SHARED ? L"IPC shared" : L"IPC pipe";
+		return options;
+	}
+
+	DWORD Endpoint::PreferredNumaNode() const
+	{
+		if (options_.numa_node != NUMA_NO_PREFERRED_NODE)
+			return options_.numa_node;
+		DWORD_PTR mask = options_.io_thread.affinity_mask;
+		if (!mask)
+			return NUMA_NO_PREFERRED_NODE;
+		PROCESSOR_NUMBER processor = {};
+		processor.Group = options_.io_thread.processor_group;
+		while (!(mask & 1))
+		{
+			mask >>= 1;
+			++processor.Number;
+		}
+		USHORT node;
+		if (!::GetNumaProcessorNodeEx(&processor, &node))
+			return NUMA_NO_PREFERRED_NODE;
+		return node;
+	}
+
 	BasicIterPC* Endpoint::GetControl()
 	{
 		return iterpc_Impl_;
@@ -3,25 +3,160 @@
 #include "ipc/ipc_common.h"
 #include "ipc/ipc_utils.h"
 #include "ipc/ipc_basic.h"
+#include "ipc/ipc_async.h"
+#include "ipc/ipc_pending_call.h"
+#include "ipc/basic_thread.h"
+
+#include <functional>
+#include <vector>
 
 
 namespace IPC
 {
+	class IOThreadPool;
+	class MessageExecutor;
+	class PollQueue;
+	class ReliableLink;
+
 	class Endpoint : public Sender, public Receiver
 	{
 	public:
 		enum EndpointMethod { METHOD_PIPE, METHOD_SHARED };
 
-		Endpoint(const ipc_tstring& name, Receiver* receiver, EndpointMethod method = METHOD_PIPE, bool start_now = true);
+		struct Options {
+			Options()
+				: checksum(false), single_loop(false), io_thread_pool(NULL), executor(NULL)
+				, poll_queue(NULL), numa_node(NUMA_NO_PREFERRED_NODE), reliable(false)
+				, max_unacked(0), reconnect_delay_ms(50), max_reconnect_delay_ms(5000) {}
+
+			// METHOD_SHARED: stamp each record written to the segment with a
+			// CRC32C. See SharedMem::set_checksum.
+			bool checksum;
+
+			// METHOD_SHARED: service both directions from one thread that
+			// sleeps until a task is posted or the peer signals, instead of a
+			// reader and a writer thread that poll every 2 ms.
+			bool single_loop;
+
+			// METHOD_PIPE: run the channel on a worker of this pool instead of
+			// a thread of its own. The pool must outlive the endpoint.
+			IOThreadPool* io_thread_pool;
+
+			// Hand received messages to this executor instead of calling the
+			// receiver on the IO thread. OnConnected and OnError are still
+			// called on the IO thread. The executor must outlive the endpoint.
+			MessageExecutor* executor;
+
+			// Queue every receiver callback, OnConnected and OnError included,
+			// on this queue for the application thread to Dispatch, instead of
+			// calling the receiver on the IO thread. Takes precedence over
+			// |executor|. The queue must outlive the endpoint.
+			PollQueue* poll_queue;
+
+			// Affinity, priority and name of the endpoint's own IO threads.
+			// Unnamed threads are called "IPC pipe" or "IPC shared". Not used with
+			// |io_thread_pool|; the pool takes its own options.
+			ThreadOptions io_thread;
+
+			// METHOD_SHARED: preferred node passed to CreateFileMappingNuma
+			// when this side creates the segment, or the node of the first
+			// processor in |io_thread.affinity_mask| if not set. It applies
+			// to the whole segment, both directions; a side that opens an
+			// existing segment ignores it.
+			DWORD numa_node;
+
+			// METHOD_PIPE: keep every message sent until the peer acknowledges
+			// it, and replay what the peer missed once a broken pipe is
+			// connected again; see ReliableLink. Send then only fails while
+			// shutting down or with |max_unacked| messages held, and pending
+			// calls wait out a reconnect instead of failing. The peer must be
+			// reliable too.
+			bool reliable;
+
+			// Reliable mode: most messages held for the peer; 0 is no bound.
+			size_t max_unacked;
+
+			// Reliable mode: wait before reconnecting after an error or a
+			// failed attempt, doubled after each failure up to
+			// |max_reconnect_delay_ms| and reset once connected.
+			DWORD reconnect_delay_ms;
+			DWORD max_reconnect_delay_ms;
+		};
+
+		Endpoint(const ipc_tstring& name, Receiver* receiver, EndpointMethod method = METHOD_PIPE, bool start_now = true,
+			const Options& options = Options());
 		~Endpoint();
 
 		void Start();
 
+		// Stops accepting sends, writes out everything already sent and waits
+		// for the peer to confirm it has read it. Returns as soon as it has, or
+		// after about |timeout_ms|; if the IO thread is too busy to drain by
+		// then, nothing is counted. On the IO thread the drain runs right
+		// away; a shared-memory channel cannot write from a receiver callback,
+		// so there nothing is flushed. Received messages are still delivered
+		// until the endpoint is destroyed.
+		DrainResult Shutdown(DWORD timeout_ms);
+
 		bool IsConnected() const;
 
 		virtual bool Send(Message* message) override;
 
-		//virtual bool SendS(Message* message) ;//synchro
+		// Sends the messages in [first, last) with a single task posted to the
+		// IO thread, where they reach the transport together and go out in
+		// as few writes as it can manage. Takes ownership of every message;
+		// returns false if none could be sent.
+		template <class Iterator>
+		bool SendBatch(Iterator first, Iterator last)
+		{
+			std::vector<ScopedPtr<Message> > batch;
+			for (; first != last; ++first)
+				batch.push_back(ScopedPtr<Message>(*first));
+			return PostBatch(batch);
+		}
+
+		bool SendBatch(Message* const* messages, size_t count)
+		{
+			return SendBatch(messages, messages + count);
+		}
+
+		// Like Send, then calls |callback| on the IO thread once the message
+		// has been handed to the pipe or written to the segment, or with
+		// false if it is thrown away. Not called back if this returns false.
+		// In reliable mode false means the pipe is down; the message is kept
+		// and goes out after the reconnect.
+		bool SendAndNotify(Message* message, BasicIterPC::WriteCallback callback, void* context);
+
+		// Sends |message| as a call: it gets a request id, and the peer
+		// answers with a message made by Message::GenerateReply. |call| must
+		// have |complete| set and stay alive until it runs, with the reply on
+		// the thread that receives it, or with NULL if the peer goes away or
+		// the endpoint closes first, or after |timeout_ms|. Any number of calls
+		// may be outstanding and their replies may come in any order. Returns
+		// false, without calling back, if the call could not be sent.
+		bool StartCall(Message* message, PendingCall* call, DWORD timeout_ms = INFINITE);
+
+		// Receives the reply of CallAsync, or NULL if the call failed or
+		// expired. The reply is only valid during the callback.
+		typedef std::function<void(Message* reply)> ReplyCallback;
+
+		// StartCall for callers that would rather not keep a PendingCall.
+		bool CallAsync(Message* message, ReplyCallback callback, DWORD timeout_ms = INFINITE);
+
+		// Coroutine forms of SendAndNotify and StartCall; see ipc_async.h.
+		// The coroutine resumes on the IO thread unless |resume_on| is given.
+		SendOperation SendAsync(Message* message, basic_thread* resume_on = NULL);
+		CallOperation Call(Message* message, basic_thread* resume_on = NULL,
+			DWORD timeout_ms = INFINITE);
+
+		// Sends |message| as a call and blocks until the reply arrives or
+		// |timeout_ms| passes. Returns true, and the reply in |reply| if given,
+		// when the peer answered without setting is_reply_error(). While
+		// blocked, received messages marked should_unblock() are handled on
+		// the calling thread, so two processes calling each other do not
+		// deadlock; calls sent this way carry the mark. Fails at once on the
+		// IO thread, which would have to deliver the reply.
+		bool SendSync(Message* message, DWORD timeout_ms, ScopedPtr<Message>* reply = NULL);
 
 		virtual bool OnMessageReceived(Message* message) override;
 
@@ -33,9 +168,46 @@ namespace IPC
 	private:
 		void CreateInstance(BasicIterPC** iterpc, basic_thread** thread);
 		void Create();
-		void OnSendMessage(ScopedPtr<Message> message);
+		void OnSendMessage(const ScopedPtr<Message>& message);
+		bool PostBatch(std::vector<ScopedPtr<Message> >& batch);
+		void OnSendBatch(std::vector<ScopedPtr<Message> >& batch);
+		void OnNotifyWhenWritten(BasicIterPC::WriteCallback callback, void* context);
+		void OnSendAndNotify(const ScopedPtr<Message>& message,
+			BasicIterPC::WriteCallback callback, void* context);
+		void FailPendingCalls();
+		struct CallExpiry {
+			Endpoint* endpoint;
+			DWORD timeout_ms;
+		};
+		// PendingCallTable::ArmTimer for StartCall; |context| is a CallExpiry.
+		static ipc_ull ArmCallTimer(void* context, unsigned int request_id);
+		// Fails the call if it is still waiting; runs on the IO thread.
+		void ExpireCall(unsigned int request_id);
+		void CancelCallTimer(PendingCall* call);
+		struct SyncWaiter;
+		static void OnSyncReply(PendingCall* call, Message* reply);
+		// Hands |message| to the SendSync that blocked last; false if none.
+		bool DeliverToBlockedCaller(Message* message);
+		// Runs the receiver for a message, answering unhandled calls.
+		bool DispatchToReceiver(Message* message);
+		// Reliable mode: Create again after the current backoff delay.
+		void ScheduleReconnect();
+		void Reconnect();
 		void Close(HANDLE wait_event);
+		struct DrainState;
+		// Time Shutdown allows past the deadline for a drain that ran up
+		// to it to report back.
+		static const DWORD kDrainSlack = 50;
+		void OnDrain(ipc_ull deadline, const ScopedPtr<DrainState>& state);
+		// Channel::DrainCallback for OnDrain; |context| is a DrainState.
+		static void OnChannelDrained(void* context, const DrainResult& result);
+		void Drain(ipc_ull deadline, DrainResult* result);
+		void AddLinkBacklog(DrainResult* result) const;
+		bool IsShuttingDown() const;
 		void SetConnected(bool connect);
+		bool UsesPool() const;
+		ThreadOptions IOThreadOptions() const;
+		DWORD PreferredNumaNode() const;
 
 		ipc_tstring name_;
 		basic_thread* thread_;
@@ -44,9 +216,26 @@ namespace IPC
 		Receiver* receiver_;
 
 		EndpointMethod method_;
+		Options options_;
+
+		PendingCallTable calls_;
+
+		// Threads blocked in SendSync, innermost last.
+		Lock sync_lock_;
+		std::vector<SyncWaiter*> blocked_callers_;
+
+		// Read by every Send, so kept as flags rather than behind a lock.
+		volatile long is_connected_;
+		volatile long shutting_down_;
+
+		// The transport, once it takes Enqueue from any thread. Sends then
+		// go straight into its output queue instead of through a task.
+		BasicIterPC* volatile direct_;
 
-		mutable Lock lock_;
-		bool is_connected_;
+		// Reliable mode only.
+		ReliableLink* link_;
+		DWORD reconnect_delay_;
+		basic_thread::TimerId reconnect_timer_;
 	};
 }
 
@@ -0,0 +1,222 @@
+#include "ipc/ipc_executor.h"
+#include "ipc/ipc_messager.h"
+#include "ipc/ipc_msg.h"
+
+namespace IPC
+{
+	MessageExecutor::MessageExecutor(int thread_count)
+		: next_worker_(0)
+		, should_quit_(false)
+		, queued_messages_(0)
+		, ready_routes_(0)
+		, handled_messages_(0)
+	{
+		if (thread_count <= 0)
+			thread_count = ProcessorCount();
+		workers_.resize(thread_count);
+		for (size_t i = 0; i < workers_.size(); ++i)
+		{
+			Worker* worker = new Worker;
+			worker->owner = this;
+			worker->wake_event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+			worker->sleeping = 0;
+			worker->steals = 0;
+			workers_[i] = worker;
+		}
+		// Workers steal from each other, so all of them must exist first.
+		for (size_t i = 0; i < workers_.size(); ++i)
+			workers_[i]->thread = ::CreateThread(0, 0, WorkerMain, workers_[i], 0, 0);
+	}
+
+	MessageExecutor::~MessageExecutor()
+	{
+		should_quit_ = true;
+		for (size_t i = 0; i < workers_.size(); ++i)
+			::SetEvent(workers_[i]->wake_event);
+		for (size_t i = 0; i < workers_.size(); ++i)
+			::WaitForSingleObject(workers_[i]->thread, INFINITE);
+		// Only now: a worker still running may look into the others' queues.
+		for (size_t i = 0; i < workers_.size(); ++i)
+		{
+			::CloseHandle(workers_[i]->thread);
+			::CloseHandle(workers_[i]->wake_event);
+			delete workers_[i];
+		}
+		workers_.clear();
+		for (auto it = routes_.begin(); it != routes_.end(); ++it)
+			delete it->second;
+		routes_.clear();
+	}
+
+	void MessageExecutor::Dispatch(Receiver* receiver, const Message* message, Sender* reply_to)
+	{
+		Pending pending = { new Message(*message), reply_to };
+		RouteKey key = { receiver, message->routing_id() };
+		InterlockedIncrement(&queued_messages_);
+		Route* route;
+		bool schedule = false;
+		{
+			// Held while queuing, so the route cannot be retired in between.
+			AutoLock lock(routes_lock_);
+			Route*& entry = routes_[key];
+			if (!entry)
+			{
+				entry = new Route(receiver, key.routing_id);
+				schedule = true;
+			}
+			route = entry;
+			AutoLock route_lock(route->lock);
+			route->messages.push(std::move(pending));
+		}
+		if (schedule)
+			Schedule(route, NULL);
+	}
+
+	MessageExecutor::Stats MessageExecutor::GetStats() const
+	{
+		Stats stats;
+		stats.queued_messages = queued_messages_;
+		stats.ready_routes = ready_routes_;
+		stats.handled_messages = handled_messages_;
+		stats.steals = 0;
+		for (size_t i = 0; i < workers_.size(); ++i)
+			stats.steals += workers_[i]->steals;
+		return stats;
+	}
+
+	DWORD WINAPI MessageExecutor::WorkerMain(LPVOID params)
+	{
+		Worker* worker = static_cast<Worker*>(params);
+		worker->owner->Run(worker);
+		return 0;
+	}
+
+	void MessageExecutor::Run(Worker* worker)
+	{
+		for (;;)
+		{
+			Route* route = TakeRoute(worker);
+			if (!route)
+			{
+				// Publish that we are about to sleep, then look once more: a
+				// route queued before the flag was visible is found here, one
+				// queued after it wakes us.
+				InterlockedExchange(&worker->sleeping, 1);
+				route = TakeRoute(worker);
+				if (!route)
+				{
+					if (should_quit_)
+						return;
+					::WaitForSingleObject(worker->wake_event, INFINITE);
+				}
+				InterlockedExchange(&worker->sleeping, 0);
+				if (!route)
+					continue;
+			}
+			RunRoute(worker, route);
+		}
+	}
+
+	MessageExecutor::Route* MessageExecutor::TakeRoute(Worker* worker)
+	{
+		Route* route = NULL;
+		{
+			AutoLock lock(worker->lock);
+			if (!worker->ready.empty())
+			{
+				route = worker->ready.front();
+				worker->ready.pop_front();
+			}
+		}
+		if (!route)
+		{
+			size_t self = 0;
+			while (workers_[self] != worker)
+				++self;
+			for (size_t i = 1; i < workers_.size() && !route; ++i)
+			{
+				Worker* victim = workers_[(self + i) % workers_.size()];
+				AutoLock lock(victim->lock);
+				if (!victim->ready.empty())
+				{
+					route = victim->ready.back();
+					victim->ready.pop_back();
+				}
+			}
+			if (route)
+				InterlockedIncrement(&worker->steals);
+		}
+		if (route)
+			InterlockedDecrement(&ready_routes_);
+		return route;
+	}
+
+	void MessageExecutor::RunRoute(Worker* worker, Route* route)
+	{
+		for (int i = 0; i < kMaxBatch; ++i)
+		{
+			Pending pending;
+			{
+				AutoLock lock(route->lock);
+				if (route->messages.empty())
+					break;
+				pending = std::move(route->messages.front());
+				route->messages.pop();
+			}
+			if (!route->receiver->OnMessageReceived(pending.message.get()))
+				Message::ReplyUnhandled(pending.reply_to, pending.message.get());
+			InterlockedDecrement(&queued_messages_);
+			InterlockedIncrement(&handled_messages_);
+		}
+
+		if (Retire(route))
+			return;
+		// Still busy: requeue behind the other ready routes.
+		Schedule(route, worker);
+	}
+
+	bool MessageExecutor::Retire(Route* route)
+	{
+		{
+			AutoLock routes_lock(routes_lock_);
+			AutoLock lock(route->lock);
+			if (!route->messages.empty())
+				return false;
+			RouteKey key = { route->receiver, route->routing_id };
+			routes_.erase(key);
+		}
+		delete route;
+		return true;
+	}
+
+	void MessageExecutor::Schedule(Route* route, Worker* worker)
+	{
+		if (!worker)
+		{
+			long turn = InterlockedIncrement(&next_worker_);
+			worker = workers_[static_cast<unsigned long>(turn) % workers_.size()];
+		}
+		InterlockedIncrement(&ready_routes_);
+		{
+			AutoLock lock(worker->lock);
+			worker->ready.push_back(route);
+		}
+
+		// If the owner is busy, an idle worker can steal the route.
+		if (Wake(worker))
+			return;
+		for (size_t i = 0; i < workers_.size(); ++i)
+		{
+			if (workers_[i] != worker && Wake(workers_[i]))
+				return;
+		}
+	}
+
+	bool MessageExecutor::Wake(Worker* worker)
+	{
+		if (InterlockedCompareExchange(&worker->sleeping, 0, 1) != 1)
+			return false;
+		::SetEvent(worker->wake_event);
+		return true;
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+namespace IPC
+{
+	// Runs OnMessageReceived on a pool of worker threads instead of the IO
+	// thread, so a slow handler no longer holds up reading the channel.
+	//
+	// Messages are queued per (receiver, routing id). A route is handed to one
+	// worker at a time, so messages with the same routing id are handled one
+	// after another in the order they arrived, while different routes run in
+	// parallel. Each worker keeps its own queue of ready routes; a worker that
+	// runs out takes routes from the back of the others' queues.
+	//
+	// Receivers must outlive the executor or every message queued for them.
+	class MessageExecutor
+	{
+	public:
+		struct Stats {
+			// Messages accepted and not yet handled.
+			long queued_messages;
+			// Routes with messages waiting for a worker.
+			long ready_routes;
+			// Messages handled so far.
+			long handled_messages;
+			// Routes a worker took from another worker's queue.
+			long steals;
+		};
+
+		// Starts |thread_count| workers, or one per processor if it is 0.
+		explicit MessageExecutor(int thread_count = 0);
+		// Handles the messages still queued, then stops the workers.
+		~MessageExecutor();
+
+		// Queues a copy of |message| for |receiver|. May be called from any
+		// thread; |message| is not referenced after the call returns. A call
+		// the receiver does not handle is answered with an error through
+		// |reply_to|, which must live as long as |receiver|.
+		void Dispatch(Receiver* receiver, const Message* message, Sender* reply_to = NULL);
+
+		Stats GetStats() const;
+
+		int thread_count() const { return static_cast<int>(workers_.size()); }
+
+	private:
+		// Messages a worker handles from one route before giving others a turn.
+		enum { kMaxBatch = 32 };
+
+		struct Pending {
+			ScopedPtr<Message> message;
+			Sender* reply_to;
+		};
+
+		// A route lives from the first message queued for it until a worker
+		// finds it empty, sitting in a ready queue or with one worker all that
+		// time, so |routes_| only holds routes with work.
+		struct Route {
+			Route(Receiver* r, int id) : receiver(r), routing_id(id) {}
+			Receiver* const receiver;
+			const int routing_id;
+
+			Lock lock;
+			FifoQueue<Pending> messages;
+		};
+
+		struct RouteKey {
+			Receiver* receiver;
+			int routing_id;
+			bool operator==(const RouteKey& other) const {
+				return receiver == other.receiver && routing_id == other.routing_id;
+			}
+		};
+
+		struct RouteKeyHash {
+			size_t operator()(const RouteKey& key) const {
+				return reinterpret_cast<size_t>(key.receiver) * 31 +
+					static_cast<size_t>(key.routing_id);
+			}
+		};
+
+		struct Worker {
+			MessageExecutor* owner;
+			HANDLE thread;
+			HANDLE wake_event;
+			// Set while the worker waits on |wake_event|; see Wake.
+			volatile long sleeping;
+			volatile long steals;
+
+			Lock lock;
+			std::deque<Route*> ready;
+		};
+
+		static DWORD WINAPI WorkerMain(LPVOID params);
+
+		void Run(Worker* worker);
+		// Takes the next route from |worker|'s queue, or steals one.
+		Route* TakeRoute(Worker* worker);
+		// Handles up to kMaxBatch messages of |route|.
+		void RunRoute(Worker* worker, Route* route);
+		// Deletes |route| if no message is left for it.
+		bool Retire(Route* route);
+		// Queues |route| on |worker|, or on the next worker in turn.
+		void Schedule(Route* route, Worker* worker);
+		// Wakes |worker| if it sleeps; returns false if it was awake.
+		bool Wake(Worker* worker);
+
+		std::vector<Worker*> workers_;
+		volatile long next_worker_;
+		volatile bool should_quit_;
+
+		// Taken before a route's lock where both are held.
+		Lock routes_lock_;
+		std::unordered_map<RouteKey, Route*, RouteKeyHash> routes_;
+
+		volatile long queued_messages_;
+		volatile long ready_routes_;
+		volatile long handled_messages_;
+
+		DISALLOW_COPY_AND_ASSIGN(MessageExecutor);
+	};
+}
@@ -0,0 +1,63 @@
+#include "ipc/ipc_io_thread_pool.h"
+#include "ipc/ipc_thread.h"
+#include <cassert>
+
+namespace IPC
+{
+	IOThreadPool::IOThreadPool(int thread_count, const ThreadOptions& options)
+	{
+		if (thread_count <= 0)
+			thread_count = ProcessorCount();
+		workers_.resize(thread_count);
+		for (size_t i = 0; i < workers_.size(); ++i)
+		{
+			ThreadOptions worker_options = options;
+			worker_options.name = (options.name.empty() ? L"IPC IO" : options.name) +
+				L" " + std::to_wstring(i);
+			workers_[i].thread = new Thread;
+			workers_[i].channels = 0;
+			workers_[i].thread->SetOptions(worker_options);
+			workers_[i].thread->Start();
+		}
+	}
+
+	IOThreadPool::~IOThreadPool()
+	{
+		for (size_t i = 0; i < workers_.size(); ++i)
+		{
+			assert(workers_[i].channels == 0);
+			workers_[i].thread->Stop();
+			workers_[i].thread->Wait(2000);
+			delete workers_[i].thread;
+		}
+		workers_.clear();
+	}
+
+	Thread* IOThreadPool::Acquire()
+	{
+		AutoLock lock(lock_);
+		Worker* least = &workers_[0];
+		for (size_t i = 1; i < workers_.size(); ++i)
+		{
+			if (workers_[i].channels < least->channels)
+				least = &workers_[i];
+		}
+		++least->channels;
+		return least->thread;
+	}
+
+	void IOThreadPool::Release(Thread* thread)
+	{
+		AutoLock lock(lock_);
+		for (size_t i = 0; i < workers_.size(); ++i)
+		{
+			if (workers_[i].thread == thread)
+			{
+				assert(workers_[i].channels > 0);
+				--workers_[i].channels;
+				return;
+			}
+		}
+		assert(false);
+	}
+}
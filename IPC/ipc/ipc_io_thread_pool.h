@@ -0,0 +1,48 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+#include "ipc/basic_thread.h"
+
+#include <vector>
+
+namespace IPC
+{
+	class Thread;
+
+	// A fixed set of IO threads shared by the pipe endpoints of a process.
+	// Each worker is a Thread with its own completion port; a channel is
+	// registered with exactly one worker for its whole life, so its callbacks
+	// stay serialized while the number of threads no longer grows with the
+	// number of endpoints. Channels go to the worker serving the fewest.
+	//
+	// The pool must outlive every endpoint that uses it.
+	class IOThreadPool
+	{
+	public:
+		// Starts |thread_count| workers, or one per processor if it is 0.
+		// Workers are named "<options.name> <n>", "IPC IO <n>" by default.
+		explicit IOThreadPool(int thread_count = 0,
+			const ThreadOptions& options = ThreadOptions());
+		~IOThreadPool();
+
+		// Returns the least loaded worker and counts one more channel on it.
+		Thread* Acquire();
+
+		// Gives back a worker returned by Acquire once its channel is closed.
+		void Release(Thread* thread);
+
+		int thread_count() const { return static_cast<int>(workers_.size()); }
+
+	private:
+		struct Worker {
+			Thread* thread;
+			int channels;
+		};
+
+		mutable Lock lock_;
+		std::vector<Worker> workers_;
+
+		DISALLOW_COPY_AND_ASSIGN(IOThreadPool);
+	};
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include "ipc/ipc_msg.h"
+#include "ipc/ipc_message_utils.h"
+
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Declaring messages
+// ------------------
+// Messages are declared in a header shared by both processes. Each group of
+// messages belongs to a message class, a small integer chosen by the
+// application; class 0 is reserved for the channel's own hello/goodbye
+// messages.
+//
+//   enum SampleMessageClass { SampleMsgStart = 1 };
+//
+//   #define IPC_MESSAGE_START SampleMsgStart
+//   IPC_MESSAGE_CONTROL(SampleMsg_Hello, std::string)
+//   IPC_MESSAGE_ROUTED(SampleMsg_Frame, int, IPC::ArrayView<char>)
+//
+// generates the classes SampleMsg_Hello and SampleMsg_Frame. Their constructors
+// take the parameters (routed messages take the routing id first) and write
+// them with WriteParams. A message's type() is its class in the upper 16 bits
+// and the line it was declared on in the lower 16 bits, so the declaring
+// header must stay identical on both sides.
+//
+// Dispatching
+// -----------
+// MessageDispatcher keeps one handler table per message class, indexed by the
+// declaration line. Looking up a handler is two array indexes no matter how
+// many messages are registered:
+//
+//   SampleClient::SampleClient() : dispatcher_(this) {
+//     IPC_DISPATCHER_ADD(dispatcher_, SampleMsg_Frame, &SampleClient::OnFrame);
+//   }
+//   bool SampleClient::OnMessageReceived(IPC::Message* msg) {
+//     return dispatcher_.Dispatch(msg);
+//   }
+//   void SampleClient::OnFrame(int id, const IPC::ArrayView<char>& pixels);
+
+#define IPC_MESSAGE_ID(klass, line) \
+	((static_cast<unsigned int>(klass) << 16) | static_cast<unsigned int>(line))
+#define IPC_MESSAGE_ID_CLASS(id) ((id) >> 16)
+#define IPC_MESSAGE_ID_LINE(id) ((id) & 0xffff)
+
+#define IPC_MESSAGE_DECL(kind, msg_class, ...) \
+	struct msg_class##_Meta { \
+		static const unsigned int ID = IPC_MESSAGE_ID(IPC_MESSAGE_START, __LINE__); \
+		static const char* Name() { return #msg_class; } \
+	}; \
+	typedef IPC::MessageT<msg_class##_Meta, std::tuple<__VA_ARGS__>, kind> msg_class;
+
+#define IPC_MESSAGE_CONTROL(msg_class, ...) \
+	IPC_MESSAGE_DECL(IPC::MESSAGE_KIND_CONTROL, msg_class, __VA_ARGS__)
+
+#define IPC_MESSAGE_ROUTED(msg_class, ...) \
+	IPC_MESSAGE_DECL(IPC::MESSAGE_KIND_ROUTED, msg_class, __VA_ARGS__)
+
+#define IPC_DISPATCHER_ADD(dispatcher, msg_class, method) \
+	(dispatcher).template Add<msg_class, decltype(method), method>()
+
+namespace IPC
+{
+	enum MessageKind {
+		MESSAGE_KIND_CONTROL,  // sent with MSG_ROUTING_CONTROL
+		MESSAGE_KIND_ROUTED,   // sent to an explicit routing id
+	};
+
+	namespace internal {
+
+		template <class T, class Method, class Param, size_t... I>
+		void DispatchToMethod(T* obj, Method method, const Param& p, std::index_sequence<I...>) {
+			(obj->*method)(std::get<I>(p)...);
+		}
+
+	}  // namespace internal
+
+	template <class Meta, class Params>
+	class MessageTBase;
+
+	template <class Meta, class Params, MessageKind kind>
+	class MessageT;
+
+	template <class Meta, class... Ins>
+	class MessageTBase<Meta, std::tuple<Ins...> > : public Message
+	{
+	public:
+		typedef std::tuple<Ins...> Param;
+		static const unsigned int ID = Meta::ID;
+
+		static const char* Name() {
+			return Meta::Name();
+		}
+
+		static bool Read(const Message* msg, Param* p) {
+			MessageReader reader(msg);
+			return ReadParams(&reader, p);
+		}
+
+		// Reads the parameters of |msg| and calls |method| on |obj| with them.
+		// Returns false if the payload does not hold them.
+		template <class T, class Method>
+		static bool Dispatch(const Message* msg, T* obj, Method method) {
+			Param p;
+			if (!Read(msg, &p))
+				return false;
+			internal::DispatchToMethod(obj, method, p, std::index_sequence_for<Ins...>());
+			return true;
+		}
+
+	protected:
+		MessageTBase(int routing_id, const Ins&... ins)
+			: Message(routing_id, ID, PRIORITY_NORMAL) {
+			WriteParams(this, ins...);
+		}
+		~MessageTBase() {}
+	};
+
+	template <class Meta, class... Ins>
+	class MessageT<Meta, std::tuple<Ins...>, MESSAGE_KIND_CONTROL>
+		: public MessageTBase<Meta, std::tuple<Ins...> >
+	{
+	public:
+		explicit MessageT(const Ins&... ins)
+			: MessageTBase<Meta, std::tuple<Ins...> >(MSG_ROUTING_CONTROL, ins...) {}
+	protected:
+		~MessageT() {}
+	};
+
+	template <class Meta, class... Ins>
+	class MessageT<Meta, std::tuple<Ins...>, MESSAGE_KIND_ROUTED>
+		: public MessageTBase<Meta, std::tuple<Ins...> >
+	{
+	public:
+		MessageT(int routing_id, const Ins&... ins)
+			: MessageTBase<Meta, std::tuple<Ins...> >(routing_id, ins...) {}
+	protected:
+		~MessageT() {}
+	};
+
+	// Dispatches declared messages to member functions of |T|.
+	template <class T>
+	class MessageDispatcher
+	{
+	public:
+		typedef bool(*Handler)(T* owner, const Message* msg);
+
+		explicit MessageDispatcher(T* owner) : owner_(owner) {}
+
+		// Use IPC_DISPATCHER_ADD rather than calling this directly.
+		template <class Msg, class Method, Method method>
+		void Add() {
+			Set(Msg::ID, &Invoke<Msg, Method, method>);
+		}
+
+		// Calls the handler registered for |msg|. Returns false if there is
+		// none, or if the payload does not hold the declared parameters.
+		bool Dispatch(const Message* msg) const {
+			unsigned int type = msg->type();
+			unsigned int klass = IPC_MESSAGE_ID_CLASS(type);
+			if (klass >= tables_.size())
+				return false;
+			const Table& table = tables_[klass];
+			// Lines before |first_line| wrap around to large values.
+			unsigned int index = IPC_MESSAGE_ID_LINE(type) - table.first_line;
+			if (index >= table.handlers.size() || !table.handlers[index])
+				return false;
+			return table.handlers[index](owner_, msg);
+		}
+
+	private:
+		struct Table {
+			Table() : first_line(0) {}
+			unsigned int first_line;
+			std::vector<Handler> handlers;
+		};
+
+		template <class Msg, class Method, Method method>
+		static bool Invoke(T* owner, const Message* msg) {
+			return Msg::Dispatch(msg, owner, method);
+		}
+
+		void Set(unsigned int id, Handler handler) {
+			unsigned int klass = IPC_MESSAGE_ID_CLASS(id);
+			unsigned int line = IPC_MESSAGE_ID_LINE(id);
+			if (klass >= tables_.size())
+				tables_.resize(klass + 1);
+			Table& table = tables_[klass];
+			if (table.handlers.empty())
+				table.first_line = line;
+			else if (line < table.first_line)
+			{
+				table.handlers.insert(table.handlers.begin(), table.first_line - line, NULL);
+				table.first_line = line;
+			}
+			unsigned int index = line - table.first_line;
+			if (index >= table.handlers.size())
+				table.handlers.resize(index + 1, NULL);
+			table.handlers[index] = handler;
+		}
+
+		T* owner_;
+		std::vector<Table> tables_;
+
+		DISALLOW_COPY_AND_ASSIGN(MessageDispatcher);
+	};
+}
@@ -0,0 +1,178 @@
+#include "ipc/ipc_message_router.h"
+#include "ipc/ipc_poll_queue.h"
+#include "ipc/ipc_msg.h"
+
+#include <algorithm>
+
+namespace IPC
+{
+	namespace {
+
+		bool IsDense(int routing_id)
+		{
+			return routing_id >= 0 && routing_id < MessageRouter::kDenseRoutes;
+		}
+
+	}  // namespace
+
+	MessageRouter::MessageRouter()
+		: fallback_(NULL)
+		, reply_to_(NULL)
+	{
+	}
+
+	MessageRouter::~MessageRouter()
+	{
+	}
+
+	bool MessageRouter::AddRoute(int routing_id, Receiver* receiver, PollQueue* queue)
+	{
+		if (!receiver)
+			return false;
+		AutoLock lock(lock_);
+		Route& route = IsDense(routing_id) ? dense_[routing_id] : sparse_[routing_id];
+		if (route.receiver)
+			return false;
+		route.receiver = receiver;
+		route.queue = queue;
+		return true;
+	}
+
+	bool MessageRouter::RemoveRoute(int routing_id)
+	{
+		const DWORD self = ::GetCurrentThreadId();
+		{
+			AutoLock lock(lock_);
+			Route* route = Slot(routing_id);
+			if (!route || route->removing)
+				return false;
+			if (std::find(route->dispatching.begin(), route->dispatching.end(), self) !=
+				route->dispatching.end())
+				return false;
+			route->removing = true;
+		}
+		// Callbacks are short next to a removal; wait them out.
+		for (;;)
+		{
+			{
+				AutoLock lock(lock_);
+				if (Slot(routing_id)->dispatching.empty())
+				{
+					if (IsDense(routing_id))
+						dense_[routing_id] = Route();
+					else
+						sparse_.erase(routing_id);
+					return true;
+				}
+			}
+			Sleep(1);
+		}
+	}
+
+	void MessageRouter::set_fallback(Receiver* fallback)
+	{
+		AutoLock lock(lock_);
+		fallback_ = fallback;
+	}
+
+	bool MessageRouter::OnMessageReceived(Message* message)
+	{
+		Receiver* fallback = NULL;
+		Route* route = Enter(message->routing_id(), &fallback);
+		if (!route)
+			return fallback && fallback->OnMessageReceived(message);
+		// The route's receiver and queue do not change while it is entered.
+		bool handled = true;
+		if (route->queue)
+			route->queue->PostMessageReceived(route->receiver, message, reply_to_);
+		else
+			handled = route->receiver->OnMessageReceived(message);
+		Leave(route);
+		return handled;
+	}
+
+	void MessageRouter::OnConnected(int peer_pid)
+	{
+		std::vector<Route*> routes;
+		Receiver* fallback = NULL;
+		EnterAll(&routes, &fallback);
+		for (size_t i = 0; i < routes.size(); ++i)
+		{
+			if (routes[i]->queue)
+				routes[i]->queue->PostConnected(routes[i]->receiver, peer_pid);
+			else
+				routes[i]->receiver->OnConnected(peer_pid);
+			Leave(routes[i]);
+		}
+		if (fallback)
+			fallback->OnConnected(peer_pid);
+	}
+
+	void MessageRouter::OnError()
+	{
+		std::vector<Route*> routes;
+		Receiver* fallback = NULL;
+		EnterAll(&routes, &fallback);
+		for (size_t i = 0; i < routes.size(); ++i)
+		{
+			if (routes[i]->queue)
+				routes[i]->queue->PostError(routes[i]->receiver);
+			else
+				routes[i]->receiver->OnError();
+			Leave(routes[i]);
+		}
+		if (fallback)
+			fallback->OnError();
+	}
+
+	MessageRouter::Route* MessageRouter::Enter(int routing_id, Receiver** fallback)
+	{
+		AutoLock lock(lock_);
+		Route* route = Slot(routing_id);
+		if (route && !route->removing)
+		{
+			route->dispatching.push_back(::GetCurrentThreadId());
+			return route;
+		}
+		*fallback = fallback_;
+		return NULL;
+	}
+
+	void MessageRouter::Leave(Route* route)
+	{
+		AutoLock lock(lock_);
+		std::vector<DWORD>& threads = route->dispatching;
+		threads.erase(std::find(threads.begin(), threads.end(), ::GetCurrentThreadId()));
+	}
+
+	MessageRouter::Route* MessageRouter::Slot(int routing_id)
+	{
+		if (IsDense(routing_id))
+			return dense_[routing_id].receiver ? &dense_[routing_id] : NULL;
+		std::unordered_map<int, Route>::iterator it = sparse_.find(routing_id);
+		return it != sparse_.end() ? &it->second : NULL;
+	}
+
+	void MessageRouter::EnterAll(std::vector<Route*>* routes, Receiver** fallback)
+	{
+		AutoLock lock(lock_);
+		const DWORD self = ::GetCurrentThreadId();
+		for (int i = 0; i < kDenseRoutes; ++i)
+		{
+			if (dense_[i].receiver && !dense_[i].removing)
+			{
+				dense_[i].dispatching.push_back(self);
+				routes->push_back(&dense_[i]);
+			}
+		}
+		for (std::unordered_map<int, Route>::iterator it = sparse_.begin();
+			it != sparse_.end(); ++it)
+		{
+			if (it->second.removing)
+				continue;
+			it->second.dispatching.push_back(self);
+			routes->push_back(&it->second);
+		}
+		*fallback = fallback_;
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+#include "ipc/ipc_messager.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace IPC
+{
+	class PollQueue;
+
+	// Splits the messages of one endpoint among receivers registered per
+	// routing id, so many logical channels share one transport and one IO
+	// thread. Pass the router to the Endpoint as its receiver.
+	//
+	// Routing ids below kDenseRoutes are found by indexing an array, others
+	// through a hash map. Messages without a route, MSG_ROUTING_CONTROL
+	// included unless it has one, go to the fallback receiver. A route can
+	// have a PollQueue of its own, so each channel is handled on the thread
+	// that dispatches that queue.
+	//
+	// Shared-memory endpoints carry the sender's process id in the routing
+	// field, so routing applies to pipe endpoints.
+	class MessageRouter : public Receiver
+	{
+	public:
+		enum { kDenseRoutes = 256 };
+
+		MessageRouter();
+		virtual ~MessageRouter();
+
+		// Sends messages with |routing_id| to |receiver|, or queues them for
+		// it on |queue| if one is given. Returns false if the id is taken or
+		// |receiver| is NULL. May be called from any thread.
+		bool AddRoute(int routing_id, Receiver* receiver, PollQueue* queue = NULL);
+
+		// Removes a route, waiting for the callbacks already running for it
+		// on other threads to return, so its receiver may be deleted
+		// afterwards. Messages already posted to the route's queue are still
+		// dispatched. Returns false if there is no such route, or if called
+		// from one of its callbacks, which it would wait for forever.
+		bool RemoveRoute(int routing_id);
+
+		// Receives what no route takes. May be NULL, which is the default;
+		// such messages are then reported as unhandled.
+		void set_fallback(Receiver* fallback);
+
+		// Answers calls that a route with a queue leaves unhandled, usually
+		// the endpoint the router receives for. Others are reported to the
+		// endpoint as unhandled, which answers them itself. Set it before the
+		// endpoint is started.
+		void set_reply_to(Sender* reply_to) { reply_to_ = reply_to; }
+
+		// Receiver. OnConnected and OnError go to every route and the
+		// fallback.
+		virtual bool OnMessageReceived(Message* message) override;
+		virtual void OnConnected(int peer_pid) override;
+		virtual void OnError() override;
+
+	private:
+		struct Route {
+			Route() : receiver(NULL), queue(NULL), removing(false) {}
+			Receiver* receiver;
+			PollQueue* queue;
+			// Set by RemoveRoute; the route takes no more messages.
+			bool removing;
+			// Threads running a callback of the route, one entry per call.
+			std::vector<DWORD> dispatching;
+		};
+
+		// Returns the route for |routing_id| with the calling thread added
+		// to its |dispatching|, or NULL if it has none and the fallback takes
+		// the message. Leave must follow once the callback returns.
+		Route* Enter(int routing_id, Receiver** fallback);
+		void Leave(Route* route);
+		// Returns the slot of |routing_id|, or NULL if it holds no route.
+		Route* Slot(int routing_id);
+		// Enters every route, for the connection events.
+		void EnterAll(std::vector<Route*>* routes, Receiver** fallback);
+
+		mutable Lock lock_;
+		Route dense_[kDenseRoutes];
+		// Node-based, so a Route stays put while others are added.
+		std::unordered_map<int, Route> sparse_;
+		Receiver* fallback_;
+		Sender* reply_to_;
+
+		DISALLOW_COPY_AND_ASSIGN(MessageRouter);
+	};
+}
@@ -0,0 +1,351 @@
+#pragma once
+#include "ipc/basic_message.h"
+
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// ParamTraits describe how a C++ type is laid out in a message payload. Each
+// specialization provides:
+//
+//   kFixedSize / kSize  true and the exact byte count if every value of the
+//                       type serializes to the same size, false and 0 if not.
+//   GetSize(p)          bytes |p| takes in the payload.
+//   Write(dest, p)      copies |p| to |dest| without any capacity check and
+//                       returns the byte after it.
+//   Read(reader, p)     reads a value back, returns false on malformed input.
+//   Decode(src, p)      fixed size types only: reads a value from |src|, which
+//                       the caller has bounds checked, and returns the byte
+//                       after it.
+//
+// WriteParams() sums the sizes of all its arguments (at compile time when all
+// of them are fixed size), claims that many bytes from the message once and
+// then writes every field behind that single check. ReadParams() likewise
+// checks a fixed-size parameter list against the payload once before decoding
+// the fields. The layout matches the
+// basic_message::Write* / MessageReader::Read* methods, so both can be mixed.
+
+namespace IPC
+{
+	template <class P, class Enable = void>
+	struct ParamTraits;
+
+	// Types that are copied as their raw bytes.
+	template <class P>
+	struct FixedSizeParamTraits {
+		typedef P param_type;
+		static constexpr bool kFixedSize = true;
+		static constexpr size_t kSize = sizeof(P);
+		static size_t GetSize(const param_type&) {
+			return sizeof(P);
+		}
+		static char* Write(char* dest, const param_type& p) {
+			memcpy(dest, &p, sizeof(P));
+			return dest + sizeof(P);
+		}
+		static bool Read(MessageReader* reader, param_type* p) {
+			return reader->ReadFixed(p);
+		}
+		static const char* Decode(const char* src, param_type* p) {
+			memcpy(p, src, sizeof(P));
+			return src + sizeof(P);
+		}
+	};
+
+	template <class P>
+	struct ParamTraits<P, typename std::enable_if<
+		std::is_arithmetic<P>::value || std::is_enum<P>::value>::type>
+		: FixedSizeParamTraits<P> {
+	};
+
+	// Matches basic_message::WriteBool, which stores an int.
+	template <>
+	struct ParamTraits<bool> {
+		typedef bool param_type;
+		static constexpr bool kFixedSize = true;
+		static constexpr size_t kSize = sizeof(int);
+		static size_t GetSize(const param_type&) {
+			return sizeof(int);
+		}
+		static char* Write(char* dest, const param_type& p) {
+			return ParamTraits<int>::Write(dest, p ? 1 : 0);
+		}
+		static bool Read(MessageReader* reader, param_type* p) {
+			int value;
+			if (!ParamTraits<int>::Read(reader, &value))
+				return false;
+			*p = value != 0;
+			return true;
+		}
+		static const char* Decode(const char* src, param_type* p) {
+			int value;
+			src = ParamTraits<int>::Decode(src, &value);
+			*p = value != 0;
+			return src;
+		}
+	};
+
+	// Strings are an int element count followed by the characters.
+	template <class Char>
+	struct ParamTraits<std::basic_string<Char> > {
+		typedef std::basic_string<Char> param_type;
+		static constexpr bool kFixedSize = false;
+		static constexpr size_t kSize = 0;
+		static size_t GetSize(const param_type& p) {
+			return sizeof(int) + p.size() * sizeof(Char);
+		}
+		static char* Write(char* dest, const param_type& p) {
+			dest = ParamTraits<int>::Write(dest, static_cast<int>(p.size()));
+			memcpy(dest, p.data(), p.size() * sizeof(Char));
+			return dest + p.size() * sizeof(Char);
+		}
+		static bool Read(MessageReader* reader, param_type* p) {
+			int count;
+			const char* data;
+			if (!ParamTraits<int>::Read(reader, &count) || count < 0 ||
+				static_cast<size_t>(count) > kintmax / sizeof(Char) ||
+				!reader->ReadBytes(&data, static_cast<int>(count * sizeof(Char))))
+				return false;
+			p->resize(count);
+			if (count)
+				memcpy(&(*p)[0], data, count * sizeof(Char));
+			return true;
+		}
+	};
+
+	// Vectors are an int element count followed by the elements. Elements that
+	// are trivially copyable go through a single memcpy each way.
+	template <class P>
+	struct ParamTraits<std::vector<P> > {
+		typedef std::vector<P> param_type;
+		static constexpr bool kFixedSize = false;
+		static constexpr size_t kSize = 0;
+		static size_t GetSize(const param_type& p) {
+			return GetSize(p, std::is_trivially_copyable<P>());
+		}
+		static char* Write(char* dest, const param_type& p) {
+			dest = ParamTraits<int>::Write(dest, static_cast<int>(p.size()));
+			return Write(dest, p, std::is_trivially_copyable<P>());
+		}
+		static bool Read(MessageReader* reader, param_type* p) {
+			int count;
+			if (!ParamTraits<int>::Read(reader, &count) || count < 0)
+				return false;
+			return Read(reader, count, p, std::is_trivially_copyable<P>());
+		}
+
+	private:
+		static size_t GetSize(const param_type& p, std::true_type) {
+			return sizeof(int) + p.size() * sizeof(P);
+		}
+		static size_t GetSize(const param_type& p, std::false_type) {
+			size_t size = sizeof(int);
+			for (size_t i = 0; i < p.size(); ++i)
+				size += ParamTraits<P>::GetSize(p[i]);
+			return size;
+		}
+		static char* Write(char* dest, const param_type& p, std::true_type) {
+			if (p.empty())
+				return dest;
+			memcpy(dest, p.data(), p.size() * sizeof(P));
+			return dest + p.size() * sizeof(P);
+		}
+		static char* Write(char* dest, const param_type& p, std::false_type) {
+			for (size_t i = 0; i < p.size(); ++i)
+				dest = ParamTraits<P>::Write(dest, p[i]);
+			return dest;
+		}
+		static bool Read(MessageReader* reader, int count, param_type* p, std::true_type) {
+			ArrayView<P> view;
+			if (!reader->ReadArray(count, &view))
+				return false;
+			p->resize(count);
+			if (count)
+				memcpy(p->data(), view.data(), count * sizeof(P));
+			return true;
+		}
+		static bool Read(MessageReader* reader, int count, param_type* p, std::false_type) {
+			p->clear();
+			for (int i = 0; i < count; ++i)
+			{
+				P value;
+				if (!ParamTraits<P>::Read(reader, &value))
+					return false;
+				p->push_back(std::move(value));
+			}
+			return true;
+		}
+	};
+
+	// Same layout as std::vector. Writing copies the viewed elements; reading
+	// returns a view into the payload, so it is only valid while the message is.
+	template <class P>
+	struct ParamTraits<ArrayView<P> > {
+		typedef ArrayView<P> param_type;
+		static constexpr bool kFixedSize = false;
+		static constexpr size_t kSize = 0;
+		static size_t GetSize(const param_type& p) {
+			return sizeof(int) + p.size() * sizeof(P);
+		}
+		static char* Write(char* dest, const param_type& p) {
+			dest = ParamTraits<int>::Write(dest, static_cast<int>(p.size()));
+			if (p.empty())
+				return dest;
+			memcpy(dest, p.data(), p.size() * sizeof(P));
+			return dest + p.size() * sizeof(P);
+		}
+		static bool Read(MessageReader* reader, param_type* p) {
+			return reader->ReadArray(p);
+		}
+	};
+
+	namespace internal {
+
+		template <class... Ps>
+		struct ParamsFixedSize;
+
+		template <>
+		struct ParamsFixedSize<> {
+			static constexpr bool value = true;
+			static constexpr size_t size = 0;
+		};
+
+		template <class P, class... Ps>
+		struct ParamsFixedSize<P, Ps...> {
+			static constexpr bool value =
+				ParamTraits<P>::kFixedSize && ParamsFixedSize<Ps...>::value;
+			static constexpr size_t size =
+				ParamTraits<P>::kSize + ParamsFixedSize<Ps...>::size;
+		};
+
+		inline size_t ParamsSize() {
+			return 0;
+		}
+
+		template <class P, class... Ps>
+		size_t ParamsSize(const P& p, const Ps&... ps) {
+			return ParamTraits<P>::GetSize(p) + ParamsSize(ps...);
+		}
+
+		// All sizes known at compile time.
+		template <class... Ps>
+		size_t GetParamsSize(std::true_type, const Ps&...) {
+			return ParamsFixedSize<Ps...>::size;
+		}
+
+		template <class... Ps>
+		size_t GetParamsSize(std::false_type, const Ps&... ps) {
+			return ParamsSize(ps...);
+		}
+
+		inline char* WriteEach(char* dest) {
+			return dest;
+		}
+
+		template <class P, class... Ps>
+		char* WriteEach(char* dest, const P& p, const Ps&... ps) {
+			return WriteEach(ParamTraits<P>::Write(dest, p), ps...);
+		}
+
+		inline const char* DecodeEach(const char* src) {
+			return src;
+		}
+
+		template <class P, class... Ps>
+		const char* DecodeEach(const char* src, P* p, Ps*... ps) {
+			return DecodeEach(ParamTraits<P>::Decode(src, p), ps...);
+		}
+
+		inline bool ReadEach(MessageReader*) {
+			return true;
+		}
+
+		template <class P, class... Ps>
+		bool ReadEach(MessageReader* reader, P* p, Ps*... ps) {
+			return ParamTraits<P>::Read(reader, p) && ReadEach(reader, ps...);
+		}
+
+		// One bounds check for the whole fixed-size list.
+		template <class... Ps>
+		bool ReadParams(std::true_type, MessageReader* reader, Ps*... ps) {
+			const char* data;
+			if (!reader->ReadBytes(&data, static_cast<int>(ParamsFixedSize<Ps...>::size)))
+				return false;
+			DecodeEach(data, ps...);
+			return true;
+		}
+
+		template <class... Ps>
+		bool ReadParams(std::false_type, MessageReader* reader, Ps*... ps) {
+			return ReadEach(reader, ps...);
+		}
+
+	}  // namespace internal
+
+	// Serialized size of the given parameters.
+	template <class... Ps>
+	size_t GetParamsSize(const Ps&... ps) {
+		return internal::GetParamsSize(
+			std::integral_constant<bool, internal::ParamsFixedSize<Ps...>::value>(), ps...);
+	}
+
+	// Appends all parameters to |m| with one capacity check.
+	template <class... Ps>
+	bool WriteParams(basic_message* m, const Ps&... ps) {
+		size_t size = GetParamsSize(ps...);
+		if (size > static_cast<size_t>(kintmax))
+			return false;
+		char* dest = m->ClaimBytes(static_cast<int>(size));
+		if (!dest)
+			return false;
+		internal::WriteEach(dest, ps...);
+		return true;
+	}
+
+	template <class... Ps>
+	bool ReadParams(MessageReader* reader, Ps*... ps) {
+		return internal::ReadParams(
+			std::integral_constant<bool, internal::ParamsFixedSize<Ps...>::value>(), reader, ps...);
+	}
+
+	// Tuples are their elements back to back, so a message declared with a
+	// parameter list can be read into a std::tuple of those types.
+	template <class... Ps>
+	struct ParamTraits<std::tuple<Ps...> > {
+		typedef std::tuple<Ps...> param_type;
+		static constexpr bool kFixedSize = internal::ParamsFixedSize<Ps...>::value;
+		static constexpr size_t kSize = internal::ParamsFixedSize<Ps...>::size;
+		static size_t GetSize(const param_type& p) {
+			return GetSize(p, std::index_sequence_for<Ps...>());
+		}
+		static char* Write(char* dest, const param_type& p) {
+			return Write(dest, p, std::index_sequence_for<Ps...>());
+		}
+		static bool Read(MessageReader* reader, param_type* p) {
+			return Read(reader, p, std::index_sequence_for<Ps...>());
+		}
+		static const char* Decode(const char* src, param_type* p) {
+			return Decode(src, p, std::index_sequence_for<Ps...>());
+		}
+
+	private:
+		template <size_t... I>
+		static size_t GetSize(const param_type& p, std::index_sequence<I...>) {
+			return GetParamsSize(std::get<I>(p)...);
+		}
+		template <size_t... I>
+		static char* Write(char* dest, const param_type& p, std::index_sequence<I...>) {
+			return internal::WriteEach(dest, std::get<I>(p)...);
+		}
+		template <size_t... I>
+		static bool Read(MessageReader* reader, param_type* p, std::index_sequence<I...>) {
+			return ReadParams(reader, &std::get<I>(*p)...);
+		}
+		template <size_t... I>
+		static const char* Decode(const char* src, param_type* p, std::index_sequence<I...>) {
+			return internal::DecodeEach(src, &std::get<I>(*p)...);
+		}
+	};
+}
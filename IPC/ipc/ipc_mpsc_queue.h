@@ -0,0 +1,91 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+
+namespace IPC
+{
+	// Link field for objects queued on an MpscQueue.
+	struct MpscQueueNode {
+		MpscQueueNode* volatile next;
+	};
+
+	// Intrusive, unbounded multi-producer/single-consumer FIFO. Push is one
+	// interlocked exchange and never blocks; Pop and IsEmpty may only be called
+	// from the single consumer thread. |T| must derive from MpscQueueNode. The
+	// queue does not own the nodes.
+	//
+	// A producer links its node in two steps, so for a moment the consumer can
+	// see a queue that is neither empty nor able to pop: Pop returns NULL while
+	// IsEmpty returns false. Callers that sleep on IsEmpty must retry instead.
+	template <class T>
+	class MpscQueue
+	{
+	public:
+		MpscQueue() : head_(&stub_), tail_(&stub_)
+		{
+			stub_.next = NULL;
+		}
+
+		void Push(T* node)
+		{
+			PushNode(static_cast<MpscQueueNode*>(node));
+		}
+
+		// Returns the oldest node, or NULL if there is none ready.
+		T* Pop()
+		{
+			MpscQueueNode* head = head_;
+			MpscQueueNode* next = head->next;
+			if (head == &stub_)
+			{
+				if (!next)
+					return NULL;
+				head_ = next;
+				head = next;
+				next = next->next;
+			}
+			if (next)
+			{
+				head_ = next;
+				return static_cast<T*>(head);
+			}
+			// |head| is the last linked node. Unless a push is in progress, put
+			// the stub behind it so |head| can be handed out.
+			if (head != tail_)
+				return NULL;
+			PushNode(&stub_);
+			next = head->next;
+			if (next)
+			{
+				head_ = next;
+				return static_cast<T*>(head);
+			}
+			return NULL;
+		}
+
+		// True if nothing has been pushed since the last node was popped. The
+		// read of the producer end is volatile, so a caller that publishes a
+		// flag with an interlocked operation first sees any push that missed it.
+		bool IsEmpty() const
+		{
+			return head_ == &stub_ && tail_ == &stub_;
+		}
+
+	private:
+		void PushNode(MpscQueueNode* node)
+		{
+			node->next = NULL;
+			MpscQueueNode* prev = static_cast<MpscQueueNode*>(InterlockedExchangePointer(
+				reinterpret_cast<void* volatile*>(&tail_), node));
+			prev->next = node;
+		}
+
+		// Consumer end.
+		MpscQueueNode* head_;
+		// Producer end, swapped by every push.
+		MpscQueueNode* volatile tail_;
+		MpscQueueNode stub_;
+
+		DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+	};
+}
@@ -1,4 +1,5 @@
 #include "ipc/ipc_msg.h"
+#include "ipc/ipc_messager.h"
 
 namespace IPC
 {
@@ -12,8 +13,30 @@ namespace IPC
 	{
 	}
 
+	Message::Message(const Message& other)
+		: basic_message(other)
+	{
+	}
+
 	Message::~Message(void)
 	{
 	}
 
+	Message* Message::GenerateReply(const Message* request, int routing_id)
+	{
+		Message* reply = new Message(routing_id, IPC_REPLY_ID, request->priority());
+		reply->set_reply();
+		reply->set_request_id(request->request_id());
+		return reply;
+	}
+
+	void Message::ReplyUnhandled(Sender* sender, const Message* request)
+	{
+		if (!sender || !request->is_sync())
+			return;
+		Message* reply = GenerateReply(request, ::GetCurrentProcessId());
+		reply->set_reply_error();
+		sender->Send(reply);
+	}
+
 }
\ No newline at end of file
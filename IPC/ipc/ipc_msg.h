@@ -1,5 +1,6 @@
 #pragma once
 #include "ipc/basic_message.h"
+#include "ipc/ipc_forwards.h"
 
 namespace IPC {
 
@@ -8,6 +9,18 @@ namespace IPC {
 	public:
 		Message(int routing_id, unsigned int type, PriorityValue priority);
 		Message(const char* data, int data_len);
+		Message(const Message& other);
+
+		// Creates an empty reply to the call |request|: an IPC_REPLY_ID message
+		// with its request id. |routing_id| is chosen as for any message sent
+		// on the endpoint; shared memory expects the sender's process id.
+		// Write the results into it and send it back.
+		static Message* GenerateReply(const Message* request, int routing_id);
+
+		// Tells the caller of |request| through |sender| that nobody handled
+		// it, instead of leaving it to time out. Does nothing unless
+		// |request| is a call.
+		static void ReplyUnhandled(Sender* sender, const Message* request);
 	protected:
 		~Message(void);
 	};
@@ -0,0 +1,80 @@
+#include "ipc/ipc_pending_call.h"
+
+namespace IPC
+{
+	PendingCallTable::PendingCallTable()
+		: free_head_(kNoSlot)
+		, size_(0)
+	{
+	}
+
+	bool PendingCallTable::Insert(PendingCall* call, ArmTimer arm, void* context)
+	{
+		AutoLock lock(lock_);
+		unsigned int index;
+		if (free_head_ != kNoSlot)
+		{
+			index = free_head_;
+			free_head_ = slots_[index].next_free;
+		}
+		else
+		{
+			if (slots_.size() >= kMaxCalls)
+				return false;
+			index = static_cast<unsigned int>(slots_.size());
+			Slot slot = { NULL, 0, 0, kNoSlot };
+			slots_.push_back(slot);
+		}
+		Slot& slot = slots_[index];
+		slot.generation = slot.generation % (kGenerations - 1) + 1;
+		slot.call = call;
+		call->request_id = (slot.generation << kSlotBits) | index;
+		slot.timer = arm ? arm(context, call->request_id) : 0;
+		++size_;
+		return true;
+	}
+
+	PendingCall* PendingCallTable::Take(unsigned int request_id)
+	{
+		AutoLock lock(lock_);
+		unsigned int index = request_id & (kMaxCalls - 1);
+		if (index >= slots_.size() || !slots_[index].call ||
+			slots_[index].generation != request_id >> kSlotBits)
+			return NULL;
+		return Free(index);
+	}
+
+	PendingCall* PendingCallTable::TakeAll()
+	{
+		AutoLock lock(lock_);
+		PendingCall* all = NULL;
+		for (size_t i = 0; i < slots_.size() && size_; ++i)
+		{
+			if (!slots_[i].call)
+				continue;
+			PendingCall* call = Free(static_cast<unsigned int>(i));
+			call->next = all;
+			all = call;
+		}
+		return all;
+	}
+
+	size_t PendingCallTable::size() const
+	{
+		AutoLock lock(lock_);
+		return size_;
+	}
+
+	PendingCall* PendingCallTable::Free(unsigned int index)
+	{
+		Slot& slot = slots_[index];
+		PendingCall* call = slot.call;
+		call->timer = slot.timer;
+		call->next = NULL;
+		slot.call = NULL;
+		slot.next_free = free_head_;
+		free_head_ = index;
+		--size_;
+		return call;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+
+#include <vector>
+
+namespace IPC
+{
+	class Message;
+
+	// A call waiting for its reply. The caller owns it, typically inside the
+	// object that waits, and keeps it alive until |complete| has run, so
+	// tracking a call allocates nothing.
+	struct PendingCall {
+		PendingCall() : request_id(0), complete(NULL), context(NULL), timer(0), next(NULL) {}
+
+		unsigned int request_id;
+		// Receives the reply, or NULL if the call failed or expired. The
+		// reply is only valid during the callback.
+		void(*complete)(PendingCall* call, Message* reply);
+		void* context;
+		// Filled in by PendingCallTable::Take: the timer armed by Insert, or
+		// 0 if the call has no deadline.
+		ipc_ull timer;
+		// Links the list returned by PendingCallTable::TakeAll.
+		PendingCall* next;
+	};
+
+	// The calls an endpoint has sent and not yet seen answered. A request id
+	// holds a slot index and the slot's generation, so finding a call is an
+	// index and a compare, and a late reply to a call that expired misses
+	// the call now using its slot. Freed slots are reused first.
+	class PendingCallTable
+	{
+	public:
+		// Request ids have 24 bits: the slot index and a generation that
+		// starts at 1, so no id is 0.
+		enum { kSlotBits = 14, kMaxCalls = 1 << kSlotBits };
+
+		// Starts the timer that expires the call |request_id| and returns its
+		// id.
+		typedef ipc_ull(*ArmTimer)(void* context, unsigned int request_id);
+
+		PendingCallTable();
+
+		// Stores |call| and gives it a request id. Returns false if kMaxCalls
+		// calls are outstanding already. |arm|, if given, runs with the table
+		// locked, so the timer is posted before anyone can take the call and
+		// cancel it.
+		bool Insert(PendingCall* call, ArmTimer arm = NULL, void* context = NULL);
+
+		// Removes and returns the call waiting for |request_id|, or NULL if
+		// it was already taken.
+		PendingCall* Take(unsigned int request_id);
+
+		// Removes every call and returns them as a list linked through
+		// |next|.
+		PendingCall* TakeAll();
+
+		size_t size() const;
+
+	private:
+		enum { kGenerations = 1 << (24 - kSlotBits) };
+		static const unsigned int kNoSlot = 0xFFFFFFFF;
+
+		struct Slot {
+			PendingCall* call;
+			ipc_ull timer;
+			unsigned int generation;
+			unsigned int next_free;
+		};
+
+		// Empties |index|, handing its timer to its call.
+		PendingCall* Free(unsigned int index);
+
+		mutable Lock lock_;
+		std::vector<Slot> slots_;
+		unsigned int free_head_;
+		size_t size_;
+
+		DISALLOW_COPY_AND_ASSIGN(PendingCallTable);
+	};
+}
@@ -0,0 +1,99 @@
+#include "ipc/ipc_poll_queue.h"
+#include "ipc/ipc_messager.h"
+#include "ipc/ipc_msg.h"
+
+namespace IPC
+{
+	PollQueue::PollQueue()
+		: wake_event_(::CreateEvent(NULL, TRUE, FALSE, NULL))
+		, wake_callback_(NULL)
+		, wake_context_(NULL)
+	{
+	}
+
+	PollQueue::~PollQueue()
+	{
+		CloseHandle(wake_event_);
+	}
+
+	void PollQueue::set_wake_callback(WakeCallback callback, void* context)
+	{
+		AutoLock lock(lock_);
+		wake_callback_ = callback;
+		wake_context_ = context;
+	}
+
+	void PollQueue::PostMessageReceived(Receiver* receiver, const Message* message,
+		Sender* reply_to)
+	{
+		Event event = { EVENT_MESSAGE, receiver, new Message(*message), reply_to, 0 };
+		Post(event);
+	}
+
+	void PollQueue::PostConnected(Receiver* receiver, int peer_pid)
+	{
+		Event event = { EVENT_CONNECTED, receiver, NULL, NULL, peer_pid };
+		Post(event);
+	}
+
+	void PollQueue::PostError(Receiver* receiver)
+	{
+		Event event = { EVENT_ERROR, receiver, NULL, NULL, 0 };
+		Post(event);
+	}
+
+	void PollQueue::Post(Event& event)
+	{
+		WakeCallback callback = NULL;
+		void* context = NULL;
+		{
+			AutoLock lock(lock_);
+			bool first = pending_.empty();
+			pending_.push_back(std::move(event));
+			if (!first)
+				return;
+			callback = wake_callback_;
+			context = wake_context_;
+			::SetEvent(wake_event_);
+		}
+		if (callback)
+			callback(context);
+	}
+
+	size_t PollQueue::Dispatch()
+	{
+		{
+			AutoLock lock(lock_);
+			if (pending_.empty())
+				return 0;
+			pending_.swap(dispatching_);
+			::ResetEvent(wake_event_);
+		}
+		size_t count = dispatching_.size();
+		for (size_t i = 0; i < count; ++i)
+		{
+			Event& event = dispatching_[i];
+			switch (event.type)
+			{
+			case EVENT_MESSAGE:
+				if (!event.receiver->OnMessageReceived(event.message.get()))
+					Message::ReplyUnhandled(event.reply_to, event.message.get());
+				break;
+			case EVENT_CONNECTED:
+				event.receiver->OnConnected(event.peer_pid);
+				break;
+			case EVENT_ERROR:
+				event.receiver->OnError();
+				break;
+			}
+		}
+		dispatching_.clear();
+		return count;
+	}
+
+	bool PollQueue::empty() const
+	{
+		AutoLock lock(lock_);
+		return pending_.empty();
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+
+#include <vector>
+
+namespace IPC
+{
+	class Receiver;
+
+	// Collects receiver callbacks for a thread that wants to handle them
+	// itself, such as a UI or game-loop thread, instead of on the IO thread.
+	// IO threads append to the queue; the owning thread calls Dispatch, e.g.
+	// at the top of each frame, and gets everything queued so far in one pass.
+	//
+	// The owner is woken once per batch rather than once per message: the
+	// first callback queued after a Dispatch sets wake_event() and runs the
+	// wake callback, and the ones behind it just join the batch.
+	//
+	// Receivers must outlive the queue or every callback queued for them.
+	class PollQueue
+	{
+	public:
+		// Called on the IO thread when a batch starts, e.g. to PostMessage to
+		// a window. It must not call Dispatch.
+		typedef void(*WakeCallback)(void* context);
+
+		PollQueue();
+		~PollQueue();
+
+		void set_wake_callback(WakeCallback callback, void* context);
+
+		// Signaled while callbacks wait for Dispatch, for use with
+		// WaitForMultipleObjects or MsgWaitForMultipleObjects.
+		HANDLE wake_event() const { return wake_event_; }
+
+		// Queue a copy of |message|, or the connection events, for
+		// |receiver|. May be called from any thread. A call the receiver does
+		// not handle is answered with an error through |reply_to|, which must
+		// live as long as |receiver|.
+		void PostMessageReceived(Receiver* receiver, const Message* message,
+			Sender* reply_to = NULL);
+		void PostConnected(Receiver* receiver, int peer_pid);
+		void PostError(Receiver* receiver);
+
+		// Runs the callbacks queued so far on the calling thread, in the order
+		// they were queued, and returns how many ran. Callbacks queued while
+		// it runs form the next batch. Call it from one thread, and not from
+		// inside a callback it runs.
+		size_t Dispatch();
+
+		bool empty() const;
+
+	private:
+		enum EventType { EVENT_MESSAGE, EVENT_CONNECTED, EVENT_ERROR };
+
+		struct Event {
+			EventType type;
+			Receiver* receiver;
+			ScopedPtr<Message> message;
+			Sender* reply_to;
+			int peer_pid;
+		};
+
+		void Post(Event& event);
+
+		mutable Lock lock_;
+		std::vector<Event> pending_;
+		// Swapped with |pending_| by Dispatch so both keep their capacity.
+		std::vector<Event> dispatching_;
+
+		HANDLE wake_event_;
+		WakeCallback wake_callback_;
+		void* wake_context_;
+
+		DISALLOW_COPY_AND_ASSIGN(PollQueue);
+	};
+}
@@ -0,0 +1,192 @@
+#include "ipc/ipc_reliable.h"
+#include "ipc/ipc_basic.h"
+#include "ipc/ipc_msg.h"
+#include <functional>
+#include <vector>
+
+namespace IPC
+{
+	ReliableLink::ReliableLink(basic_thread* thread, size_t max_unacked)
+		: thread_(thread)
+		, max_unacked_(max_unacked)
+		, reserved_(0)
+		, transport_(NULL)
+		, resumed_(false)
+		// Never 0, which stands for a peer not heard from yet.
+		, session_(RandGenerator(static_cast<ipc_ull>(-1)) | 1)
+		, first_retained_(0)
+		, peer_session_(0)
+		, received_(0)
+		, acked_(0)
+		, ack_timer_(0)
+	{
+	}
+
+	ReliableLink::~ReliableLink()
+	{
+		CancelAckTimer();
+	}
+
+	bool ReliableLink::Reserve(size_t count)
+	{
+		long total = ::InterlockedExchangeAdd(&reserved_, static_cast<long>(count)) +
+			static_cast<long>(count);
+		if (!max_unacked_ || static_cast<size_t>(total) <= max_unacked_)
+			return true;
+		Unreserve(count);
+		return false;
+	}
+
+	void ReliableLink::Unreserve(size_t count)
+	{
+		::InterlockedExchangeAdd(&reserved_, -static_cast<long>(count));
+	}
+
+	void ReliableLink::Attach(BasicIterPC* transport)
+	{
+		transport_ = transport;
+		resumed_ = false;
+		// The first message on every pipe; ours are held back until the
+		// peer's arrives.
+		ScopedPtr<Message> m(new Message(MSG_ROUTING_NONE, RESUME_MESSAGE_TYPE,
+			Message::PRIORITY_NORMAL));
+		m->WriteUInt64(session_);
+		m->WriteUInt64(peer_session_);
+		m->WriteUInt64(received_);
+		acked_ = received_;
+		CancelAckTimer();
+		transport_->Send(m.get());
+	}
+
+	void ReliableLink::Detach()
+	{
+		transport_ = NULL;
+		resumed_ = false;
+		CancelAckTimer();
+	}
+
+	bool ReliableLink::Send(const ScopedPtr<Message>& message)
+	{
+		retained_.push(message);
+		if (!resumed_)
+			return false;
+		transport_->Send(message.get());
+		return true;
+	}
+
+	bool ReliableLink::SendBatch(ScopedPtr<Message>* messages, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			retained_.push(messages[i]);
+		if (!resumed_)
+			return false;
+		transport_->SendBatch(messages, count);
+		return true;
+	}
+
+	bool ReliableLink::OnMessageReceived(const Message* message)
+	{
+		if (message->routing_id() == MSG_ROUTING_NONE)
+		{
+			if (message->type() == RESUME_MESSAGE_TYPE)
+			{
+				OnResume(message);
+				return true;
+			}
+			if (message->type() == ACK_MESSAGE_TYPE)
+			{
+				MessageReader reader(message);
+				ipc_ull received = 0;
+				if (reader.ReadUInt64(&received))
+					Release(received);
+				return true;
+			}
+		}
+		++received_;
+		if (received_ - acked_ >= kAckBatch)
+		{
+			CancelAckTimer();
+			SendAck();
+		}
+		else if (!ack_timer_ && thread_)
+		{
+			ack_timer_ = thread_->PostDelayedTask(std::bind(&ReliableLink::OnAckTimer, this),
+				kAckDelay);
+		}
+		return false;
+	}
+
+	void ReliableLink::OnResume(const Message* message)
+	{
+		MessageReader reader(message);
+		ipc_ull peer_session = 0;
+		ipc_ull about_session = 0;
+		ipc_ull received = 0;
+		if (!reader.ReadUInt64(&peer_session) || !reader.ReadUInt64(&about_session) ||
+			!reader.ReadUInt64(&received) || !transport_)
+			return;
+
+		// A peer we have not heard from, or one that restarted, numbers its
+		// messages from 0 again.
+		if (peer_session != peer_session_)
+		{
+			peer_session_ = peer_session;
+			received_ = 0;
+			acked_ = 0;
+		}
+		// The same goes the other way: what it got from an earlier link of
+		// ours is gone, so what we still hold is renumbered from 0.
+		if (about_session != session_)
+		{
+			first_retained_ = 0;
+			received = 0;
+		}
+		Release(received);
+
+		resumed_ = true;
+		if (retained_.empty())
+			return;
+		std::vector<ScopedPtr<Message> > replay;
+		replay.reserve(retained_.size());
+		for (size_t i = 0; i < retained_.size(); ++i)
+			replay.push_back(retained_[i]);
+		transport_->SendBatch(replay.data(), replay.size());
+	}
+
+	void ReliableLink::Release(ipc_ull received)
+	{
+		size_t released = 0;
+		while (first_retained_ < received && !retained_.empty())
+		{
+			retained_.pop();
+			++first_retained_;
+			++released;
+		}
+		if (released)
+			Unreserve(released);
+	}
+
+	void ReliableLink::OnAckTimer()
+	{
+		ack_timer_ = 0;
+		SendAck();
+	}
+
+	void ReliableLink::SendAck()
+	{
+		if (!transport_ || acked_ == received_)
+			return;
+		ScopedPtr<Message> m(new Message(MSG_ROUTING_NONE, ACK_MESSAGE_TYPE,
+			Message::PRIORITY_NORMAL));
+		m->WriteUInt64(received_);
+		acked_ = received_;
+		transport_->Send(m.get());
+	}
+
+	void ReliableLink::CancelAckTimer()
+	{
+		if (ack_timer_ && thread_)
+			thread_->CancelTimer(ack_timer_);
+		ack_timer_ = 0;
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+#include "ipc/basic_thread.h"
+
+namespace IPC
+{
+	class BasicIterPC;
+
+	// Keeps what an endpoint sends until the peer has acknowledged it, so
+	// nothing is lost when the pipe breaks and a new one is connected.
+	//
+	// Every message sent through the link takes the next sequence number.
+	// The pipe delivers in order, so the number is implied by the position
+	// and not written into the message. The receiving link counts what it
+	// gets and acknowledges the count in batches. When a pipe connects,
+	// each side first states how many messages of the other's it holds;
+	// the other drops those and replays the rest before sending anything
+	// new. Both endpoints of a pipe must use a link.
+	//
+	// Runs on the endpoint's IO thread, except Reserve and Unreserve.
+	class ReliableLink
+	{
+	public:
+		enum {
+			// Routed to MSG_ROUTING_NONE like the channel's own messages.
+			RESUME_MESSAGE_TYPE = kushortmax - 3,
+			ACK_MESSAGE_TYPE = kushortmax - 4
+		};
+
+		// Received messages are acknowledged after this many, or this long
+		// after the first one not yet acknowledged.
+		static const ipc_ull kAckBatch = 64;
+		static const DWORD kAckDelay = 50;
+
+		// |max_unacked| bounds the messages held for the peer; 0 is no
+		// bound.
+		ReliableLink(basic_thread* thread, size_t max_unacked);
+		~ReliableLink();
+
+		// Claims room for |count| messages before they are posted to the IO
+		// thread. Returns false if the link holds too many already. May be
+		// called from any thread.
+		bool Reserve(size_t count);
+		void Unreserve(size_t count);
+
+		// Starts the resume handshake on a newly connected |transport|.
+		void Attach(BasicIterPC* transport);
+		// Forgets the transport once it is closed, keeping every message
+		// not yet acknowledged.
+		void Detach();
+
+		// Numbers and keeps |message|, a reserved one, and sends it if the
+		// handshake is done. Returns true if it went to the transport now.
+		bool Send(const ScopedPtr<Message>& message);
+		bool SendBatch(ScopedPtr<Message>* messages, size_t count);
+
+		// Takes the link's own messages and counts the others. Returns true
+		// if |message| was the link's and is not to be dispatched.
+		bool OnMessageReceived(const Message* message);
+
+		// True once the peer has resumed on the current transport.
+		bool resumed() const { return resumed_; }
+		// Messages sent or waiting to be, not yet acknowledged.
+		size_t unacked() const { return retained_.size(); }
+
+	private:
+		void OnResume(const Message* message);
+		// Drops what the peer says it has; |received| counts from 0.
+		void Release(ipc_ull received);
+		void OnAckTimer();
+		void SendAck();
+		void CancelAckTimer();
+
+		basic_thread* thread_;
+		const size_t max_unacked_;
+		volatile long reserved_;
+
+		BasicIterPC* transport_;
+		bool resumed_;
+
+		// Identifies this link to the peer, so it can tell a restarted
+		// process from a reconnect.
+		const ipc_ull session_;
+
+		// Outbound: |retained_| holds the messages numbered from
+		// |first_retained_|.
+		FifoQueue<ScopedPtr<Message> > retained_;
+		ipc_ull first_retained_;
+
+		// Inbound: messages received from the peer's session so far, and
+		// how many of them were acknowledged.
+		ipc_ull peer_session_;
+		ipc_ull received_;
+		ipc_ull acked_;
+		basic_thread::TimerId ack_timer_;
+
+		DISALLOW_COPY_AND_ASSIGN(ReliableLink);
+	};
+}
@@ -0,0 +1,566 @@
+#include "ipc/ipc_shared_bus.h"
+#include "ipc/ipc_msg.h"
+#include <algorithm>
+#include <climits>
+
+#if defined(_M_IX86)
+#include <intrin.h>
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+namespace IPC
+{
+	namespace internal {
+
+		const ipc_ui kBusMagic = 0x53554242;  // "BBUS"
+		const ipc_ui kBusVersion = 1;
+
+		// The publisher's fields and the subscribers' waiter count sit on
+		// separate cache lines.
+		struct BusHeader {
+			volatile ipc_ui magic;
+			ipc_ui version;
+			ipc_ui capacity;
+			ipc_ui max_subscribers;
+			ipc_ui policy;
+			ipc_ui reserved[11];
+			// Written by the publisher only. Everything below |write_pos| and
+			// from |tail_pos| on is intact; |tail_pos| moves before the space
+			// behind it is reused.
+			volatile ipc_ll write_pos;
+			volatile ipc_ll tail_pos;
+			volatile ipc_ll next_sequence;
+			char pad0[40];
+			// Subscribers sleeping in Wait.
+			volatile long waiters;
+			char pad1[60];
+		};
+
+		enum SlotState {
+			SLOT_FREE,
+			SLOT_CLAIMING,
+			SLOT_ACTIVE,
+			// Dropped back by the publisher; the subscriber skips ahead.
+			SLOT_DROPPED,
+		};
+
+		struct BusSlot {
+			volatile long state;
+			DWORD pid;
+			// Start of the next record the subscriber will read.
+			volatile ipc_ll cursor;
+			char pad[48];
+		};
+
+		struct BusRecord {
+			ipc_ui size;     // Whole record, header included.
+			ipc_ui length;   // Message bytes; 0 for padding.
+			ipc_ull sequence;
+		};
+	}
+
+	using namespace internal;
+
+	namespace {
+
+		const ipc_ui kRecordAlignment = sizeof(BusRecord);
+
+		// Reads a position with acquire semantics, so the records before it
+		// are visible, and without writing to the publisher's cache line.
+		ipc_ll LoadPosition(volatile ipc_ll* position)
+		{
+#if defined(_M_IX86)
+			// Two 32-bit reads could tear; an aligned 8-byte SSE2 load does
+			// not. x86 keeps loads in order, so only the compiler is fenced.
+			__m128i value = _mm_loadl_epi64(
+				reinterpret_cast<const __m128i*>(const_cast<ipc_ll*>(position)));
+			_ReadWriteBarrier();
+			ipc_ll result;
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(&result), value);
+			return result;
+#elif defined(_M_ARM64)
+			// Volatile reads are not acquires under /volatile:iso.
+			return static_cast<ipc_ll>(__ldar64(
+				reinterpret_cast<volatile unsigned __int64*>(position)));
+#else
+			// x64: an aligned read is atomic, and volatile reads are acquires
+			// under /volatile:ms.
+			return *position;
+#endif
+		}
+
+		// A process we may not query is taken to be alive.
+		bool ProcessAlive(DWORD pid)
+		{
+			HANDLE process = ::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+			if (!process)
+				return ::GetLastError() == ERROR_ACCESS_DENIED;
+			DWORD code = 0;
+			bool alive = ::GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+			::CloseHandle(process);
+			return alive;
+		}
+
+		size_t RoundCapacity(size_t capacity)
+		{
+			size_t rounded = SharedBus::kMinCapacity;
+			while (rounded < capacity && rounded < SharedBus::kMaxCapacity)
+				rounded <<= 1;
+			return rounded;
+		}
+
+	}  // namespace
+
+	SharedBus::SharedBus(const ipc_tstring& name)
+		: name_(name)
+		, map_(NULL)
+		, wake_(NULL)
+		, header_(NULL)
+		, ring_(NULL)
+		, capacity_(0)
+	{
+	}
+
+	SharedBus::~SharedBus()
+	{
+		UnmapSegment();
+	}
+
+	const ipc_tstring SharedBus::MapName(const ipc_tstring& bus_id)
+	{
+		ipc_tstring name(TEXT("Local\\bus."));
+		return name.append(bus_id);
+	}
+
+	size_t SharedBus::SegmentSize(size_t capacity, size_t max_subscribers)
+	{
+		return sizeof(BusHeader) + max_subscribers * sizeof(BusSlot) + capacity;
+	}
+
+	bool SharedBus::MapSegment()
+	{
+		void* data = ::MapViewOfFile(map_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+		if (!data)
+			return false;
+		header_ = static_cast<BusHeader*>(data);
+		// Counts a release per waiter; a count left over by a waiter that
+		// timed out only causes a spurious wake-up.
+		ipc_tstring wake_name = MapName(name_) + TEXT(".wake");
+		wake_ = ::CreateSemaphore(NULL, 0, LONG_MAX, wake_name.c_str());
+		return wake_ != NULL;
+	}
+
+	void SharedBus::UnmapSegment()
+	{
+		if (header_)
+			::UnmapViewOfFile(header_);
+		if (wake_)
+			::CloseHandle(wake_);
+		if (map_)
+			::CloseHandle(map_);
+		header_ = NULL;
+		wake_ = NULL;
+		map_ = NULL;
+		ring_ = NULL;
+	}
+
+	BusSlot* SharedBus::slot(size_t index) const
+	{
+		return reinterpret_cast<BusSlot*>(header_ + 1) + index;
+	}
+
+	BusRecord* SharedBus::RecordAt(ipc_ll position) const
+	{
+		return reinterpret_cast<BusRecord*>(ring_ + (position & (capacity_ - 1)));
+	}
+
+	size_t SharedBus::FreeDeadSlots()
+	{
+		size_t freed = 0;
+		for (size_t i = 0; i < header_->max_subscribers; ++i)
+		{
+			BusSlot* s = slot(i);
+			// |pid| is set before a slot becomes active.
+			long state = s->state;
+			if ((state != SLOT_ACTIVE && state != SLOT_DROPPED) || ProcessAlive(s->pid))
+				continue;
+			if (::InterlockedCompareExchange(&s->state, SLOT_FREE, state) == state)
+				++freed;
+		}
+		return freed;
+	}
+
+	SharedBusPublisher::SharedBusPublisher(const ipc_tstring& name, size_t capacity,
+		OverflowPolicy policy, size_t max_subscribers)
+		: SharedBus(name)
+		, policy_(policy)
+		, max_subscribers_((std::min)((std::max)(max_subscribers, static_cast<size_t>(1)),
+			static_cast<size_t>(kMaxSubscribers)))
+		, next_sequence_(0)
+		, min_cursor_(0)
+	{
+		capacity_ = RoundCapacity(capacity);
+	}
+
+	SharedBusPublisher::~SharedBusPublisher()
+	{
+		Close();
+	}
+
+	bool SharedBusPublisher::Open()
+	{
+		AutoLock lock(lock_);
+		if (header_)
+			return true;
+		ipc_tstring name = MapName(name_);
+		bool created = false;
+		map_ = ::OpenFileMapping(FILE_MAP_ALL_ACCESS, 0, name.c_str());
+		if (!map_)
+		{
+			map_ = ::CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+				PAGE_READWRITE | SEC_COMMIT, 0,
+				static_cast<DWORD>(SegmentSize(capacity_, max_subscribers_)),
+				name.c_str());
+			created = true;
+		}
+		if (!map_ || !MapSegment())
+		{
+			UnmapSegment();
+			return false;
+		}
+		ring_ = reinterpret_cast<char*>(slot(max_subscribers_));
+		if (created)
+		{
+			// The mapping starts zeroed; subscribers wait for the magic.
+			header_->version = kBusVersion;
+			header_->capacity = static_cast<ipc_ui>(capacity_);
+			header_->max_subscribers = static_cast<ipc_ui>(max_subscribers_);
+			header_->policy = policy_;
+			::MemoryBarrier();
+			header_->magic = kBusMagic;
+			next_sequence_ = 0;
+			min_cursor_ = 0;
+			return true;
+		}
+		if (header_->magic != kBusMagic || header_->version != kBusVersion ||
+			header_->capacity != capacity_ || header_->max_subscribers != max_subscribers_)
+		{
+			UnmapSegment();
+			return false;
+		}
+		// Carry on where the previous publisher stopped.
+		header_->policy = policy_;
+		next_sequence_ = header_->next_sequence;
+		min_cursor_ = header_->tail_pos;
+		return true;
+	}
+
+	void SharedBusPublisher::Close()
+	{
+		AutoLock lock(lock_);
+		UnmapSegment();
+	}
+
+	bool SharedBusPublisher::Send(Message* message)
+	{
+		ScopedPtr<Message> m(message);
+		AutoLock lock(lock_);
+		if (!header_)
+			return false;
+		size_t length = m->size();
+		if (length == 0 || length > capacity_ / 4)
+			return false;
+		ipc_ll size = (sizeof(BusRecord) + length + kRecordAlignment - 1) & ~static_cast<size_t>(kRecordAlignment - 1);
+		ipc_ll write = header_->write_pos;
+		// Records never wrap; pad out the end of the ring instead.
+		ipc_ll offset = write & (capacity_ - 1);
+		ipc_ll padding = offset + size > static_cast<ipc_ll>(capacity_) ? capacity_ - offset : 0;
+		if (!MakeRoom(write, padding + size))
+			return false;
+		if (padding)
+		{
+			BusRecord* pad = RecordAt(write);
+			pad->size = static_cast<ipc_ui>(padding);
+			pad->length = 0;
+			pad->sequence = 0;
+			write += padding;
+		}
+		BusRecord* record = RecordAt(write);
+		record->size = static_cast<ipc_ui>(size);
+		record->length = static_cast<ipc_ui>(length);
+		record->sequence = next_sequence_++;
+		memcpy(record + 1, m->data(), length);
+		::InterlockedExchange64(&header_->next_sequence, next_sequence_);
+		// Full barrier: the record is visible before the position, and the
+		// position before the waiter count is read.
+		::InterlockedExchange64(&header_->write_pos, write + size);
+		WakeSubscribers();
+		return true;
+	}
+
+	bool SharedBusPublisher::MakeRoom(ipc_ll write, ipc_ll needed)
+	{
+		const ipc_ll capacity = static_cast<ipc_ll>(capacity_);
+		ipc_ll tail = header_->tail_pos;
+		if (write + needed - tail <= capacity)
+			return true;
+		if (policy_ == OVERFLOW_BLOCK && write + needed - min_cursor_ > capacity)
+		{
+			min_cursor_ = SlowestCursor(write, tail);
+			if (write + needed - min_cursor_ > capacity)
+				return false;
+		}
+		while (write + needed - tail > capacity)
+			tail += RecordAt(tail)->size;
+		// Subscribers copying a record behind the new tail see it moved once
+		// they are done and throw the copy away.
+		::InterlockedExchange64(&header_->tail_pos, tail);
+		return true;
+	}
+
+	ipc_ll SharedBusPublisher::SlowestCursor(ipc_ll write, ipc_ll tail) const
+	{
+		ipc_ll slowest = write;
+		for (size_t i = 0; i < max_subscribers_; ++i)
+		{
+			BusSlot* s = slot(i);
+			long state = s->state;
+			// A subscriber still opening has not published its cursor; it
+			// starts no earlier than the records still in the ring.
+			if (state == SLOT_CLAIMING)
+			{
+				slowest = (std::min)(slowest, tail);
+				continue;
+			}
+			if (state != SLOT_ACTIVE)
+				continue;
+			ipc_ll cursor = LoadPosition(&s->cursor);
+			if (cursor < slowest)
+				slowest = cursor;
+		}
+		// A subscriber behind the tail has lost those records already.
+		return (std::max)(slowest, tail);
+	}
+
+	void SharedBusPublisher::WakeSubscribers()
+	{
+		if (header_->waiters <= 0)
+			return;
+		long waiters = ::InterlockedExchange(&header_->waiters, 0);
+		if (waiters > 0)
+			::ReleaseSemaphore(wake_, waiters, NULL);
+	}
+
+	size_t SharedBusPublisher::DropLagging(size_t max_lag)
+	{
+		AutoLock lock(lock_);
+		if (!header_)
+			return 0;
+		size_t dropped = FreeDeadSlots();
+		ipc_ll write = header_->write_pos;
+		for (size_t i = 0; i < max_subscribers_; ++i)
+		{
+			BusSlot* s = slot(i);
+			if (s->state != SLOT_ACTIVE ||
+				write - LoadPosition(&s->cursor) <= static_cast<ipc_ll>(max_lag))
+				continue;
+			if (::InterlockedCompareExchange(&s->state, SLOT_DROPPED, SLOT_ACTIVE) == SLOT_ACTIVE)
+				++dropped;
+		}
+		return dropped;
+	}
+
+	size_t SharedBusPublisher::subscriber_count() const
+	{
+		AutoLock lock(lock_);
+		if (!header_)
+			return 0;
+		size_t count = 0;
+		for (size_t i = 0; i < max_subscribers_; ++i)
+		{
+			long state = slot(i)->state;
+			if (state == SLOT_ACTIVE || state == SLOT_DROPPED)
+				++count;
+		}
+		return count;
+	}
+
+	SharedBusSubscriber::SharedBusSubscriber(const ipc_tstring& name)
+		: SharedBus(name)
+		, slot_(NULL)
+		, cursor_(0)
+		, next_sequence_(0)
+		, has_sequence_(false)
+		, lost_messages_(0)
+	{
+	}
+
+	SharedBusSubscriber::~SharedBusSubscriber()
+	{
+		Close();
+	}
+
+	bool SharedBusSubscriber::Open()
+	{
+		if (slot_)
+			return true;
+		map_ = ::OpenFileMapping(FILE_MAP_ALL_ACCESS, 0, MapName(name_).c_str());
+		if (!map_ || !MapSegment() ||
+			header_->magic != kBusMagic || header_->version != kBusVersion)
+		{
+			UnmapSegment();
+			return false;
+		}
+		::MemoryBarrier();
+		capacity_ = header_->capacity;
+		ring_ = reinterpret_cast<char*>(slot(header_->max_subscribers));
+		BusSlot* s = ClaimSlot();
+		// Slots of subscribers that died without closing are only looked
+		// for once the table is full.
+		if (!s && FreeDeadSlots())
+			s = ClaimSlot();
+		if (!s)
+		{
+			UnmapSegment();
+			return false;
+		}
+		s->pid = ::GetCurrentProcessId();
+		slot_ = s;
+		cursor_ = LoadPosition(&header_->write_pos);
+		// Read after the position, so it can only be ahead of the first
+		// record and never reports a loss that did not happen.
+		next_sequence_ = LoadPosition(&header_->next_sequence);
+		has_sequence_ = true;
+		PublishCursor();
+		::InterlockedExchange(&s->state, SLOT_ACTIVE);
+		return true;
+	}
+
+	BusSlot* SharedBusSubscriber::ClaimSlot()
+	{
+		for (size_t i = 0; i < header_->max_subscribers; ++i)
+		{
+			BusSlot* s = slot(i);
+			if (::InterlockedCompareExchange(&s->state, SLOT_CLAIMING, SLOT_FREE) == SLOT_FREE)
+				return s;
+		}
+		return NULL;
+	}
+
+	void SharedBusSubscriber::Close()
+	{
+		if (slot_)
+			::InterlockedExchange(&slot_->state, SLOT_FREE);
+		slot_ = NULL;
+		UnmapSegment();
+	}
+
+	size_t SharedBusSubscriber::Poll(Receiver* receiver, size_t max_messages)
+	{
+		if (!slot_)
+			return 0;
+		size_t delivered = 0;
+		while (delivered < max_messages)
+		{
+			if (slot_->state == SLOT_DROPPED)
+			{
+				CatchUp();
+				::InterlockedCompareExchange(&slot_->state, SLOT_ACTIVE, SLOT_DROPPED);
+			}
+			ipc_ll write = LoadPosition(&header_->write_pos);
+			if (cursor_ >= write)
+				break;
+			if (cursor_ < LoadPosition(&header_->tail_pos))
+			{
+				CatchUp();
+				continue;
+			}
+			// The publisher may overwrite the record while it is copied; the
+			// tail tells afterwards whether it did.
+			const BusRecord* record = RecordAt(cursor_);
+			ipc_ui size = record->size;
+			ipc_ui length = record->length;
+			ipc_ull sequence = record->sequence;
+			bool intact = size >= sizeof(BusRecord) && size % kRecordAlignment == 0 &&
+				(cursor_ & (capacity_ - 1)) + size <= capacity_ &&
+				length <= size - sizeof(BusRecord);
+			if (intact && length)
+			{
+				const char* data = reinterpret_cast<const char*>(record + 1);
+				buffer_.assign(data, data + length);
+			}
+			::MemoryBarrier();
+			if (cursor_ < LoadPosition(&header_->tail_pos))
+			{
+				CatchUp();
+				continue;
+			}
+			if (!intact)
+			{
+				// Not overwritten yet unreadable: resynchronize at the head.
+				cursor_ = write;
+				has_sequence_ = false;
+				PublishCursor();
+				continue;
+			}
+			cursor_ += size;
+			PublishCursor();
+			if (!length)
+				continue;
+			if (has_sequence_ && sequence > next_sequence_)
+				lost_messages_ += sequence - next_sequence_;
+			next_sequence_ = sequence + 1;
+			has_sequence_ = true;
+			ScopedPtr<Message> m(new Message(&buffer_[0], static_cast<int>(length)));
+			if (receiver)
+				receiver->OnMessageReceived(m.get());
+			++delivered;
+		}
+		return delivered;
+	}
+
+	bool SharedBusSubscriber::Wait(DWORD timeout_ms)
+	{
+		if (!slot_)
+			return false;
+		ipc_ull deadline = ::GetTickCount64() + timeout_ms;
+		for (;;)
+		{
+			if (HasPending())
+				return true;
+			// Registering before the second check pairs with the publisher
+			// storing the position before it reads the count.
+			::InterlockedIncrement(&header_->waiters);
+			if (HasPending())
+				return true;
+			DWORD wait = INFINITE;
+			if (timeout_ms != INFINITE)
+			{
+				ipc_ull now = ::GetTickCount64();
+				if (now >= deadline)
+					return false;
+				wait = static_cast<DWORD>(deadline - now);
+			}
+			if (::WaitForSingleObject(wake_, wait) != WAIT_OBJECT_0)
+				return HasPending();
+		}
+	}
+
+	bool SharedBusSubscriber::HasPending() const
+	{
+		return slot_ && cursor_ < LoadPosition(&header_->write_pos);
+	}
+
+	void SharedBusSubscriber::CatchUp()
+	{
+		cursor_ = LoadPosition(&header_->tail_pos);
+		PublishCursor();
+	}
+
+	void SharedBusSubscriber::PublishCursor()
+	{
+		::InterlockedExchange64(&slot_->cursor, cursor_);
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include "ipc/ipc_forwards.h"
+#include "ipc/ipc_common.h"
+#include "ipc/ipc_utils.h"
+#include "ipc/ipc_messager.h"
+
+#include <vector>
+
+namespace IPC
+{
+	// One-to-many bus over a single shared-memory segment. The publisher
+	// appends each message once to a ring; every subscriber reads it from
+	// there with a cursor of its own, so publishing costs the same whatever
+	// the number of subscribers. SharedMem remains the one-to-one transport.
+	//
+	// Segment layout: a header with the write and tail positions, a table of
+	// subscriber slots, then the ring. Records are 16-byte aligned and never
+	// wrap; the space left at the end of the ring is filled with padding.
+	namespace internal {
+		struct BusHeader;
+		struct BusSlot;
+		struct BusRecord;
+	}
+
+	class SharedBus
+	{
+	public:
+		// What the publisher does when the ring is full of records some
+		// subscriber has not read yet.
+		enum OverflowPolicy {
+			// Overwrite the oldest records. Subscribers that fall a whole ring
+			// behind skip ahead and count what they missed.
+			OVERFLOW_LAP,
+			// Refuse the message until the slowest subscriber has read enough.
+			OVERFLOW_BLOCK,
+		};
+
+		static const size_t kMinCapacity = 64 * 1024;
+		static const size_t kMaxCapacity = 256 * 1024 * 1024;
+		static const size_t kMaxSubscribers = 256;
+
+	protected:
+		explicit SharedBus(const ipc_tstring& name);
+		~SharedBus();
+
+		static const ipc_tstring MapName(const ipc_tstring& bus_id);
+		static size_t SegmentSize(size_t capacity, size_t max_subscribers);
+
+		// Maps |map_| and opens the wake semaphore.
+		bool MapSegment();
+		void UnmapSegment();
+
+		internal::BusSlot* slot(size_t index) const;
+		internal::BusRecord* RecordAt(ipc_ll position) const;
+		// Frees the slots of subscribers whose process has exited without
+		// closing. Returns how many it freed.
+		size_t FreeDeadSlots();
+
+		ipc_tstring name_;
+		HANDLE map_;
+		HANDLE wake_;
+		internal::BusHeader* header_;
+		char* ring_;
+		size_t capacity_;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(SharedBus);
+	};
+
+	// The single writer of a bus. Send may be called from any thread.
+	class SharedBusPublisher : public SharedBus, public Sender
+	{
+	public:
+		// |capacity| is rounded up to a power of two between kMinCapacity and
+		// kMaxCapacity. Messages larger than a quarter of it are refused.
+		SharedBusPublisher(const ipc_tstring& name, size_t capacity,
+			OverflowPolicy policy = OVERFLOW_LAP, size_t max_subscribers = 32);
+		~SharedBusPublisher();
+
+		// Creates the segment, or takes over the one left by a previous
+		// publisher of the same name and layout, keeping its subscribers.
+		bool Open();
+		void Close();
+
+		// Appends |message| to the ring and wakes the subscribers waiting in
+		// Wait. Takes ownership of |message|. Returns false if the bus is not
+		// open, the message is too large, or, with OVERFLOW_BLOCK, a
+		// subscriber still holds the space it needs.
+		virtual bool Send(Message* message) override;
+
+		// Skips every subscriber more than |max_lag| bytes behind to the
+		// oldest record, so OVERFLOW_BLOCK stops waiting for it. Meant for
+		// subscribers that hang. The slots of subscribers whose process has
+		// exited are freed. Returns the number of subscribers dropped back or
+		// freed.
+		size_t DropLagging(size_t max_lag);
+
+		size_t subscriber_count() const;
+		OverflowPolicy policy() const { return policy_; }
+
+	private:
+		// Moves the tail past the oldest records until |needed| more bytes
+		// fit, first checking the subscribers under OVERFLOW_BLOCK.
+		bool MakeRoom(ipc_ll write, ipc_ll needed);
+		ipc_ll SlowestCursor(ipc_ll write, ipc_ll tail) const;
+		void WakeSubscribers();
+
+		const OverflowPolicy policy_;
+		const size_t max_subscribers_;
+
+		mutable Lock lock_;
+		ipc_ull next_sequence_;
+		// Lower bound of every subscriber cursor as of the last scan; the
+		// slots are only scanned again when the ring looks full against it.
+		ipc_ll min_cursor_;
+	};
+
+	// One reader of a bus, meant for a single thread.
+	class SharedBusSubscriber : public SharedBus
+	{
+	public:
+		explicit SharedBusSubscriber(const ipc_tstring& name);
+		~SharedBusSubscriber();
+
+		// Takes a slot on the bus and starts reading at the next message
+		// published. A full table is searched again after freeing the slots
+		// of exited subscribers. Fails if there is no publisher yet or all
+		// slots are still taken.
+		bool Open();
+		void Close();
+
+		// Calls |receiver| for up to |max_messages| waiting messages, oldest
+		// first, on the calling thread, and returns how many it got. The
+		// message is only valid during the callback.
+		size_t Poll(Receiver* receiver, size_t max_messages = static_cast<size_t>(-1));
+
+		// Waits until a message is waiting or |timeout_ms| passes. Returns
+		// true if there is something to Poll.
+		bool Wait(DWORD timeout_ms);
+
+		// True if messages were published after the last one read.
+		bool HasPending() const;
+
+		// Messages overwritten before this subscriber read them.
+		ipc_ull lost_messages() const { return lost_messages_; }
+
+	private:
+		internal::BusSlot* ClaimSlot();
+		// Skips to the oldest record still in the ring.
+		void CatchUp();
+		void PublishCursor();
+
+		internal::BusSlot* slot_;
+		ipc_ll cursor_;
+		ipc_ull next_sequence_;
+		bool has_sequence_;
+		ipc_ull lost_messages_;
+		std::vector<char> buffer_;
+	};
+}
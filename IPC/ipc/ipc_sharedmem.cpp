@@ -1,17 +1,68 @@
 #include "ipc/ipc_sharedmem.h"
 #include "ipc/ipc_msg.h"
+#include "ipc/ipc_checksum.h"
+#include <algorithm>
+#include <malloc.h>
 
+namespace {
+
+	// Upper bound on idle EnqueuedMessage blocks kept for reuse.
+	const USHORT kMaxCachedNodes = 4096;
+
+	// Freed EnqueuedMessage blocks, shared by every SharedMem, so Enqueue
+	// does not allocate once a burst's worth is cached. Works like the
+	// PendingTask cache in basic_thread.cpp.
+	struct EnqueuedNodeCache {
+		EnqueuedNodeCache() { ::InitializeSListHead(&head); }
+		SLIST_HEADER head;
+	};
+
+	EnqueuedNodeCache& NodeCache()
+	{
+		static EnqueuedNodeCache cache;
+		return cache;
+	}
+
+}  // namespace
 
 namespace IPC
 {
+	void* SharedMem::EnqueuedMessage::operator new(size_t size)
+	{
+		if (PSLIST_ENTRY entry = ::InterlockedPopEntrySList(&NodeCache().head))
+			return entry;
+		void* p = _aligned_malloc(size, MEMORY_ALLOCATION_ALIGNMENT);
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void SharedMem::EnqueuedMessage::operator delete(void* p)
+	{
+		if (!p)
+			return;
+		EnqueuedNodeCache& cache = NodeCache();
+		if (::QueryDepthSList(&cache.head) < kMaxCachedNodes)
+			::InterlockedPushEntrySList(&cache.head, static_cast<PSLIST_ENTRY>(p));
+		else
+			_aligned_free(p);
+	}
+
 	SharedMem::SharedMem(const ipc_tstring& name,
-		Receiver* receiver, ThreadShared* thread)
+		Receiver* receiver, ThreadShared* thread, DWORD numa_node)
 		:BasicIterPC(name, receiver, thread),
 		waiting_connect_(true),
 		top_read_(false),
+		in_receiver_(false),
 		map_(INVALID_HANDLE_VALUE),
+		doorbell_(NULL),
+		peer_doorbell_(NULL),
 		thread_(thread),
-		self_pid_(::GetCurrentProcessId())
+		self_pid_(::GetCurrentProcessId()),
+		numa_node_(numa_node),
+		checksum_(false),
+		corrupted_messages_(0),
+		wake_pending_(0)
 	{
 		if(CreateSharedMap())
 			thread_->RegisterHandler(this);
@@ -41,11 +92,19 @@ namespace IPC
 			CloseHandle(map_);
 			map_ = INVALID_HANDLE_VALUE;
 		}
-		while (!output_queue_.empty()) {
-			Message* m = output_queue_.front();
-			output_queue_.pop();
-			m->Release();
+		if (doorbell_) {
+			CloseHandle(doorbell_);
+			doorbell_ = NULL;
+		}
+		if (peer_doorbell_) {
+			CloseHandle(peer_doorbell_);
+			peer_doorbell_ = NULL;
 		}
+		while (EnqueuedMessage* node = enqueued_.Pop())
+			delete node;
+		while (!output_queue_.empty())
+			output_queue_.pop();
+		DiscardQueued();
 	}
 
 	bool SharedMem::SayKeyWord(unsigned short word)
@@ -56,10 +115,11 @@ namespace IPC
 			if(word == GOODBYE_MESSAGE_TYPE) waiting_connect_ = true;
 			ScopedPtr<Message> m(new Message(MSG_ROUTING_NONE, word, basic_message::PRIORITY_NORMAL));
 			m->WriteUInt32(self_pid_);
-			size_t dataLen = m->size();
+			size_t dataLen = WriteRecord(pData + sizeof(unsigned int),
+				kMaximumMessageSize - sizeof(unsigned int), m.get());
 			*((unsigned int*)(pData)) = dataLen;
-			memcpy_s(pData + sizeof(unsigned int), dataLen, m->data(), dataLen);
 			spinlockw_.Unlock();
+			RingPeer();
 		}
 		return true;
 	}
@@ -67,17 +127,94 @@ namespace IPC
 	bool SharedMem::Send(Message * message)
 	{
 		if (map_ == INVALID_HANDLE_VALUE) return false;
+		// Messages enqueued earlier go first.
+		AcceptEnqueued();
 		// ensure waiting to write
 		if (!waiting_connect_)
 		{
-			AutoLock lock(lock_);
-			message->AddRef();
 			output_queue_.push(message);
+			MessageQueued();
 			return true;
 		}
 		return false;
 	}
 
+	bool SharedMem::Enqueue(const ScopedPtr<Message>& message)
+	{
+		if (map_ == INVALID_HANDLE_VALUE) return false;
+		EnqueuedMessage* node = new EnqueuedMessage;
+		node->message = message;
+		enqueued_.Push(node);
+		// The flag is set after the push, so a writer that cleared it before
+		// taking the queue either finds the node or gets woken.
+		if (InterlockedExchange(&wake_pending_, 1) == 0)
+			thread_->WakeUp();
+		return true;
+	}
+
+	void SharedMem::AcceptEnqueued()
+	{
+		InterlockedExchange(&wake_pending_, 0);
+		while (EnqueuedMessage* node = enqueued_.Pop())
+		{
+			output_queue_.push(std::move(node->message));
+			MessageQueued();
+			delete node;
+		}
+	}
+
+	DrainResult SharedMem::Drain(ipc_ull deadline)
+	{
+		AcceptEnqueued();
+		size_t queued = output_queue_.size();
+		ipc_ull written = messages_written_;
+		DrainResult result = { 0, queued, false };
+		// Both blocks share one lock, which a receiver callback on this thread
+		// holds; what is queued goes out once it returns.
+		if (thread_->single_loop() && in_receiver_)
+		{
+			result.dropped = queued;
+			return result;
+		}
+		for (;;)
+		{
+			ProcessWirteMessages();
+			// Nobody else reads for us in single-loop mode, and a peer that is
+			// draining too waits for us to make room.
+			if (thread_->single_loop())
+				ProcessReadMessages();
+			if (output_queue_.empty() && WriteBlockDrained())
+			{
+				result.acknowledged = true;
+				break;
+			}
+			ipc_ull now = ::GetTickCount64();
+			if (waiting_connect_ || map_ == INVALID_HANDLE_VALUE || now >= deadline)
+				break;
+			// The peer rings after emptying the block.
+			DWORD wait = static_cast<DWORD>((std::min)(deadline - now,
+				static_cast<ipc_ull>(kMaxDoorbellWait)));
+			if (doorbell_)
+				::WaitForSingleObject(doorbell_, wait);
+			else
+				Sleep((std::min)(wait, static_cast<DWORD>(2)));
+		}
+		result.flushed = static_cast<size_t>((std::min)(
+			messages_written_ - written, static_cast<ipc_ull>(queued)));
+		result.dropped = queued - result.flushed;
+		return result;
+	}
+
+	bool SharedMem::WriteBlockDrained()
+	{
+		char* pData = (char*)spinlockw_.Lock();
+		if (!pData)
+			return true;
+		bool drained = *((unsigned int*)(pData)) == 0;
+		spinlockw_.Unlock();
+		return drained;
+	}
+
 	const ipc_tstring SharedMem::MapName(const ipc_tstring & map_id)
 	{
 		//ipc_tstring name(TEXT("Global\\shared."));
@@ -97,10 +234,10 @@ namespace IPC
 			{
 				maperr = GetLastError(); //ERROR_FILE_NOT_FOUND
 				//create mappong file
-				map_ = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+				map_ = CreateFileMappingNuma(INVALID_HANDLE_VALUE, NULL,
 					PAGE_READWRITE | SEC_COMMIT, 0,
 					kMaximumMapSize,
-					name.c_str());
+					name.c_str(), numa_node_);
 				if (map_)
 				{
 					spinlockr_.SetOffset(kMaximumMessageSize);// map: wirte block:read block
@@ -119,9 +256,25 @@ namespace IPC
 		void* data = ::MapViewOfFile(map_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
 		spinlockw_.SetData(data);
 		spinlockr_.SetData(data);
+		CreateDoorbells(name);
 		return true;
 	}
 
+	void SharedMem::CreateDoorbells(const ipc_tstring& map_name)
+	{
+		// Named after the block whose reader waits on them.
+		ipc_tstring top = map_name + TEXT(".doorbell.top");
+		ipc_tstring bottom = map_name + TEXT(".doorbell.bottom");
+		doorbell_ = ::CreateEvent(NULL, FALSE, FALSE, (top_read_ ? top : bottom).c_str());
+		peer_doorbell_ = ::CreateEvent(NULL, FALSE, FALSE, (top_read_ ? bottom : top).c_str());
+	}
+
+	void SharedMem::RingPeer()
+	{
+		if (peer_doorbell_)
+			::SetEvent(peer_doorbell_);
+	}
+
 	int SharedMem::ContactMessages(Message* msg)
 	{
 		if(msg->routing_id() == MSG_ROUTING_NONE)
@@ -154,6 +307,7 @@ namespace IPC
 	{
 		bool invalid = true;
 		basic_message::Header hdr={0};
+		if (!msg->data()) return false;
 		if (self_pid_ == msg->routing_id()) return false;
 		return 0 == ::memcmp(msg->data(),&hdr,sizeof(hdr))? false:true;
 	}
@@ -175,69 +329,66 @@ namespace IPC
 				spinlockr_.Unlock();
 				return true;
 			}
-			size_t remainLen = dataLen;
-			bool wipe_msg = false;
-			const char* message_hdr = pData + sizeof(unsigned int);
-			const char* message_tail = Message::FindNext(message_hdr, message_hdr + remainLen);
-			while (dataLen)
+			bool consumed = true;
+			char* record_hdr = pData + sizeof(unsigned int);
+			const char* data_end = record_hdr + dataLen;
+			while (record_hdr < data_end)
 			{
 				//Timing::Timer time;
 				::OutputDebugStringA("Read-----------\n");
-				int len = static_cast<int>(message_tail - message_hdr);
-				ScopedPtr<Message> m(new Message(message_hdr, len));
-				//MessageReader reader(m);
-				if (IsValuable(m.get()))
-				{
-					//hello message ???
-					int recode = ContactMessages(m.get());
-					if (recode == 1)
-					{
-						wipe_msg = true; // other hello message
-					}
-					else if (recode == -1)
-					{
-						break;// self message, quit
-					}
-					else
-					{
-						//recv message
-						if (peer_pid_ && peer_pid_ == m->routing_id())
-						{
-							receiver_->OnMessageReceived(m.get());	
-						}
-						wipe_msg = true;
-					}
-					if (wipe_msg)
-					{
-						memset((void*)message_hdr, 0, len);
-						waitr_.Warnning();
-					}
-				}
-				else
+				// A truncated or stale record ends the block.
+				const char* record_tail = FindRecord(record_hdr, data_end);
+				if (!record_tail)
+					break;
+				const char* message_hdr = record_hdr + sizeof(RecordHeader) +
+					reinterpret_cast<RecordHeader*>(record_hdr)->padding;
+				int len = static_cast<int>(record_tail - message_hdr);
+				if (!VerifyRecord(reinterpret_cast<RecordHeader*>(record_hdr), message_hdr, len))
 				{
-					*((unsigned int*)(pData)) = 0;
+					// Sizes of the following records can not be trusted either.
+					InterlockedIncrement(&corrupted_messages_);
 					break;
 				}
-				remainLen -= len;
-				message_hdr = message_tail;
-				message_tail = Message::FindNext(message_hdr, message_hdr + remainLen);
-				if (!message_tail) {
-					*((unsigned int*)(pData)) = 0;
+				ScopedPtr<Message> m(new Message(message_hdr, len));
+				if (!IsValuable(m.get()))
 					break;
+				//hello message ???
+				int recode = ContactMessages(m.get());
+				if (recode == -1)
+				{
+					consumed = false;
+					break;// self message, quit
 				}
+				if (recode == 0 && peer_pid_ && peer_pid_ == m->routing_id())
+				{
+					//recv message
+					in_receiver_ = true;
+					receiver_->OnMessageReceived(m.get());
+					in_receiver_ = false;
+				}
+				// Wiping the framing is enough to keep the record from being
+				// parsed again.
+				memset(record_hdr, 0, sizeof(RecordHeader));
+				waitr_.Warnning();
+				record_hdr = const_cast<char*>(record_tail);
 			}
+			if (consumed)
+				*((unsigned int*)(pData)) = 0;
 			spinlockr_.Unlock();
+			// The peer may be waiting for room to write.
+			if (consumed)
+				RingPeer();
 		}
 		return true;
 	}
 
 	bool SharedMem::ProcessWirteMessages()
 	{
+		AcceptEnqueued();
 		if (waiting_connect_ || INVALID_HANDLE_VALUE == map_) return false;
 		char* pData = (char*)spinlockw_.Lock();
 		if (pData)
 		{
-			AutoLock lock(lock_);
 			//first is all message len
 			size_t dataLen = *((unsigned int*)(pData));
 			size_t remainLen = kMaximumMessageSize - dataLen - sizeof(unsigned int);
@@ -248,6 +399,7 @@ namespace IPC
 				return true;
 			}
 			char* message_hdr = pData + dataLen+ sizeof(unsigned int);
+			bool wrote = false;
 			if (!output_queue_.empty())
 			{
 				//Timing::Timer time;
@@ -256,17 +408,16 @@ namespace IPC
 				// Write to map...
 				while (!output_queue_.empty())
 				{
-					Message* m = output_queue_.front();
-					unsigned int msg_size = m->size();
-					if (msg_size <= remainLen)
+					size_t record_size = WriteRecord(message_hdr, remainLen,
+						output_queue_.front().get());
+					if (record_size)
 					{
 						output_queue_.pop();
-						//memcpy_s((void*)message_hdr, 16, m->header(), 16);
-						memcpy_s((void*)message_hdr, msg_size, m->data(), msg_size);
-						dataLen += msg_size;
-						message_hdr += msg_size;
-						remainLen -= msg_size;
-						m->Release();
+						MessageWritten();
+						wrote = true;
+						dataLen += record_size;
+						message_hdr += record_size;
+						remainLen -= record_size;
 					}
 					else
 						break;
@@ -274,10 +425,62 @@ namespace IPC
 				*((unsigned int*)(pData)) = dataLen;
 			}
 			spinlockw_.Unlock();
+			if (wrote)
+			{
+				RingPeer();
+				RunWriteCallbacks();
+			}
 		}
 		return true;
 	}
 
+	size_t SharedMem::WriteRecord(char* dest, size_t capacity, const Message* m)
+	{
+		size_t msg_size = m->size();
+		size_t padding = 0;
+		if (m->has_aligned_payload())
+		{
+			size_t alignment = basic_message::kPayloadAlignment;
+			size_t start = reinterpret_cast<size_t>(dest) + sizeof(RecordHeader);
+			padding = (alignment - start % alignment) % alignment;
+		}
+		size_t record_size = sizeof(RecordHeader) + padding + msg_size;
+		if (record_size > capacity)
+			return 0;
+
+		RecordHeader* record = reinterpret_cast<RecordHeader*>(dest);
+		record->size = static_cast<unsigned int>(record_size);
+		record->checksum = 0;
+		record->padding = static_cast<unsigned int>(padding);
+		if (checksum_)
+		{
+			record->size |= RECORD_CHECKSUM_BIT;
+			record->checksum = Crc32c(m->data(), msg_size);
+		}
+		memcpy(dest + sizeof(RecordHeader) + padding, m->data(), msg_size);
+		return record_size;
+	}
+
+	const char* SharedMem::FindRecord(const char* p, const char* end)
+	{
+		if (static_cast<size_t>(end - p) < sizeof(RecordHeader))
+			return NULL;
+		const RecordHeader* record = reinterpret_cast<const RecordHeader*>(p);
+		size_t size = record->size & RECORD_SIZE_MASK;
+		if (record->padding >= basic_message::kPayloadAlignment ||
+			size < sizeof(RecordHeader) + record->padding + sizeof(basic_message::Header) ||
+			size > static_cast<size_t>(end - p))
+			return NULL;
+		return p + size;
+	}
+
+	bool SharedMem::VerifyRecord(const RecordHeader* record, const char* message, int len)
+	{
+		if (!(record->size & RECORD_CHECKSUM_BIT))
+			return true;
+		return Crc32c(message, len) == record->checksum;
+	}
+
 	void SharedMem::OnProcessRead(HANDLE wait_event)
 	{
 		ProcessReadMessages();
@@ -285,16 +488,36 @@ namespace IPC
 		//waitr_.Wait();
 	}
 
+	void SharedMem::OnProcessLoop(HANDLE wait_event, DWORD timeout)
+	{
+		ProcessWirteMessages();
+		ProcessReadMessages();
+		if (!doorbell_)
+		{
+			Sleep(2);
+			return;
+		}
+		// A ring that arrived during the passes leaves the doorbell set, so
+		// nothing written since is missed.
+		HANDLE events[] = { wait_event, doorbell_ };
+		::WaitForMultipleObjects(2, events, FALSE, (std::min)(timeout, kMaxDoorbellWait));
+		::ResetEvent(wait_event);
+	}
+
 	void SharedMem::OnQuit()
 	{
 		SayKeyWord(GOODBYE_MESSAGE_TYPE);
 	}
 
-	void SharedMem::OnProcessWirte(HANDLE wait_event)
+	void SharedMem::OnProcessWirte(HANDLE wait_event, DWORD timeout)
 	{
 		ProcessWirteMessages();
-		//waitw_.Wait();
-		Sleep(2);
+		// Sends and tasks set |wait_event|. Messages left over wait for the
+		// peer to connect or to make room, which is polled for.
+		if (!output_queue_.empty())
+			timeout = (std::min)(timeout, static_cast<DWORD>(2));
+		::WaitForSingleObject(wait_event, timeout);
+		::ResetEvent(wait_event);
 	}
 
 }
\ No newline at end of file
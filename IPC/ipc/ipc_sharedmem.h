@@ -27,6 +27,9 @@ namespace IPC
 		static const size_t k1080pSize = 1980 * 1080 * 32;
 		static const size_t kMaximumMapSize = 512 * 1024 * 1024;
 		static const size_t kMaximumMessageSize = kMaximumMapSize/2;
+		// Longest single-loop sleep without a doorbell, in case a signal is lost
+		// with a peer that exited mid-write.
+		static const DWORD kMaxDoorbellWait = 100;
 		/*
 		class SharedSpinLockEx
 		{
@@ -152,30 +155,93 @@ namespace IPC
 			unsigned short wait_time_;
 		};
 
+		// |numa_node| is the preferred node given to CreateFileMappingNuma
+		// if this side creates the segment; it is not used otherwise.
 		SharedMem(const ipc_tstring& name,
-			Receiver* receiver, ThreadShared* thread);
+			Receiver* receiver, ThreadShared* thread,
+			DWORD numa_node = NUMA_NO_PREFERRED_NODE);
 		~SharedMem();
 
 		virtual bool Connect() override;
 		virtual void Close() override;
 		virtual bool Send(Message* message) override;
+		// Lock-free; the writer thread is woken once per burst.
+		virtual bool Enqueue(const ScopedPtr<Message>& message) override;
+		// Acknowledged once the peer has emptied our write block. Called from
+		// a receiver callback it cannot write and returns at once.
+		virtual DrainResult Drain(ipc_ull deadline) override;
 		bool SayKeyWord(unsigned short word);
+
+		// Stamps every record written to the segment with a CRC32C of the
+		// message. Records carrying a checksum are verified on receive whether
+		// or not this side writes them.
+		void set_checksum(bool checksum) { checksum_ = checksum; }
+
+		// Number of received records dropped because verification failed.
+		long corrupted_messages() const { return corrupted_messages_; }
 	private:
+		// Every message in a block is framed by a record header. |size| covers
+		// the record header, the padding and the message; RECORD_CHECKSUM_BIT in
+		// |size| marks that |checksum| holds the CRC32C of the message bytes.
+		// |padding| bytes precede the message so that messages with aligned
+		// payloads start on a basic_message::kPayloadAlignment boundary.
+#pragma pack(push, 4)
+		struct RecordHeader {
+			unsigned int size;
+			unsigned int checksum;
+			unsigned int padding;
+		};//12 BYTES
+#pragma pack(pop)
+		enum {
+			RECORD_CHECKSUM_BIT = 0x80000000,
+			RECORD_SIZE_MASK = 0x7FFFFFFF
+		};
 
 		static const ipc_tstring MapName(const ipc_tstring& map_id);
 		bool CreateSharedMap();
+		// Opens the events each side sets after writing to or draining the
+		// block the other side reads.
+		void CreateDoorbells(const ipc_tstring& map_name);
+		void RingPeer();
 		inline int ContactMessages(Message* msg);
 		inline bool IsValuable(Message* msg);
+		// Frames |m| as a record at |dest|. Returns the record size, or 0 if the
+		// record needs more than |capacity| bytes.
+		size_t WriteRecord(char* dest, size_t capacity, const Message* m);
+		// Returns the end of the record at |p|, or NULL if the record is not
+		// complete within |end|.
+		static const char* FindRecord(const char* p, const char* end);
+		static bool VerifyRecord(const RecordHeader* record, const char* message, int len);
+		virtual void AcceptEnqueued() override;
 		bool ProcessReadMessages();
 		bool ProcessWirteMessages();
+		// True once the peer has read everything in our write block.
+		bool WriteBlockDrained();
 		//inline bool ProcessMessages();
 
-		virtual void OnProcessWirte(HANDLE wait_event);
+		virtual void OnProcessWirte(HANDLE wait_event, DWORD timeout);
 		virtual void OnProcessRead(HANDLE wait_event);
+		virtual void OnProcessLoop(HANDLE wait_event, DWORD timeout);
 		virtual void OnQuit();
 	private:
-		// Messages to be sent are queued here.
-		std::queue<Message*> output_queue_;
+		// Messages to be sent are queued here. Only the writer thread touches
+		// it; other threads hand messages over through |enqueued_|.
+		FifoQueue<ScopedPtr<Message> > output_queue_;
+
+		struct EnqueuedMessage : MpscQueueNode {
+			ScopedPtr<Message> message;
+
+			// Recycled through a lock-free cache, so a steady stream of sends
+			// does not allocate.
+			static void* operator new(size_t size);
+			static void operator delete(void* p);
+		};
+		// Filled by Enqueue on any thread, emptied into |output_queue_| by
+		// the writer before each write pass.
+		MpscQueue<EnqueuedMessage> enqueued_;
+		// Set by the Enqueue that woke the writer, until the writer takes the
+		// queue; later producers of the burst skip the wakeup.
+		volatile long wake_pending_;
 
 		// In server-mode, we have to wait for the client to connect before we
 		// can begin reading.
@@ -184,6 +250,9 @@ namespace IPC
 		//true 'this' using top half map size to read from others
 		bool top_read_;
 
+		// True while the receiver runs with the segment locked.
+		bool in_receiver_;
+
 		HANDLE map_;
 
 		//read lock
@@ -193,13 +262,20 @@ namespace IPC
 		LazyWait waitr_;
 		LazyWait waitw_;
 
-		//output queue lock
-		mutable Lock lock_;
+		// Set by the peer when our read block has data or our write block has
+		// room; we set |peer_doorbell_| in turn. NULL if it could not be made.
+		HANDLE doorbell_;
+		HANDLE peer_doorbell_;
 
 		ThreadShared* thread_;
 
 		const DWORD self_pid_;
 
+		const DWORD numa_node_;
+
+		bool checksum_;
+		volatile long corrupted_messages_;
+
 		
 	};
 
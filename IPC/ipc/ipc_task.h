@@ -0,0 +1,160 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace IPC
+{
+	// A move-only replacement for std::function<void(void)>. Callables of up
+	// to kInlineSize bytes are stored inside the task, so the usual
+	// std::bind(&Class::Method, this, ScopedPtr<Message>) or a lambda with a
+	// few captures is posted without a heap allocation; larger ones are moved
+	// to the heap. Moving a task never copies the callable, so a captured
+	// ScopedPtr is handed along without touching its reference count.
+	//
+	// Callables must not throw from their move constructor.
+	class UniqueTask
+	{
+	public:
+		enum { kInlineSize = 64 };
+
+		UniqueTask() : ops_(NULL) {}
+
+		template <class F, class = typename std::enable_if<
+			!std::is_same<typename std::decay<F>::type, UniqueTask>::value>::type>
+		UniqueTask(F&& f)
+			: ops_(NULL)
+		{
+			typedef typename std::decay<F>::type Callable;
+			Init<Callable>(std::forward<F>(f), FitsInline<Callable>());
+		}
+
+		UniqueTask(UniqueTask&& other)
+			: ops_(NULL)
+		{
+			Take(other);
+		}
+
+		UniqueTask& operator=(UniqueTask&& other)
+		{
+			if (this != &other)
+			{
+				Reset();
+				Take(other);
+			}
+			return *this;
+		}
+
+		~UniqueTask()
+		{
+			Reset();
+		}
+
+		// Runs the callable. The task must not be empty. A task can be run
+		// more than once, as repeating timers do.
+		void operator()()
+		{
+			ops_->invoke(&storage_);
+		}
+
+		explicit operator bool() const
+		{
+			return ops_ != NULL;
+		}
+
+		void Reset()
+		{
+			if (ops_)
+			{
+				ops_->destroy(&storage_);
+				ops_ = NULL;
+			}
+		}
+
+	private:
+		union Storage {
+			std::max_align_t align;
+			char bytes[kInlineSize];
+		};
+
+		struct Ops {
+			void(*invoke)(void* storage);
+			// Move-constructs into |to| and destroys what is left in |from|.
+			void(*move)(void* to, void* from);
+			void(*destroy)(void* storage);
+		};
+
+		template <class F>
+		struct FitsInline : std::integral_constant<bool,
+			sizeof(F) <= sizeof(Storage) &&
+			std::alignment_of<F>::value <= std::alignment_of<Storage>::value> {
+		};
+
+		template <class F>
+		struct InlineOps {
+			static F* Get(void* storage) { return static_cast<F*>(storage); }
+			static void Invoke(void* storage) { (*Get(storage))(); }
+			static void Move(void* to, void* from)
+			{
+				new (to) F(std::move(*Get(from)));
+				Get(from)->~F();
+			}
+			static void Destroy(void* storage) { Get(storage)->~F(); }
+			static const Ops ops;
+		};
+
+		template <class F>
+		struct HeapOps {
+			static F*& Get(void* storage) { return *static_cast<F**>(storage); }
+			static void Invoke(void* storage) { (*Get(storage))(); }
+			static void Move(void* to, void* from) { new (to) F*(Get(from)); }
+			static void Destroy(void* storage) { delete Get(storage); }
+			static const Ops ops;
+		};
+
+		template <class F, class Arg>
+		void Init(Arg&& f, std::true_type)
+		{
+			new (&storage_) F(std::forward<Arg>(f));
+			ops_ = &InlineOps<F>::ops;
+		}
+
+		template <class F, class Arg>
+		void Init(Arg&& f, std::false_type)
+		{
+			new (&storage_) F*(new F(std::forward<Arg>(f)));
+			ops_ = &HeapOps<F>::ops;
+		}
+
+		void Take(UniqueTask& other)
+		{
+			if (other.ops_)
+			{
+				other.ops_->move(&storage_, &other.storage_);
+				ops_ = other.ops_;
+				other.ops_ = NULL;
+			}
+		}
+
+		const Ops* ops_;
+		Storage storage_;
+
+		UniqueTask(const UniqueTask&);
+		void operator=(const UniqueTask&);
+	};
+
+	template <class F>
+	const UniqueTask::Ops UniqueTask::InlineOps<F>::ops = {
+		&UniqueTask::InlineOps<F>::Invoke,
+		&UniqueTask::InlineOps<F>::Move,
+		&UniqueTask::InlineOps<F>::Destroy
+	};
+
+	template <class F>
+	const UniqueTask::Ops UniqueTask::HeapOps<F>::ops = {
+		&UniqueTask::HeapOps<F>::Invoke,
+		&UniqueTask::HeapOps<F>::Move,
+		&UniqueTask::HeapOps<F>::Destroy
+	};
+}
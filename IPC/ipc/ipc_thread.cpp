@@ -141,15 +141,14 @@ namespace IPC
 
 	void Thread::WaitForWork()
 	{
-		int timeout;
-		timeout = INFINITE;
-		WaitForIOCompletion(timeout, NULL);
+		WaitForIOCompletion(DelayedWorkTimeout(), NULL);
 	}
 
 	//------------------------------------------------------------------------------
 
-	ThreadShared::ThreadShared()
+	ThreadShared::ThreadShared(bool single_loop)
 		:handler_(NULL),
+		single_loop_(single_loop),
 		reader_(this),
 		wirter_(this)
 	{}
@@ -159,10 +158,39 @@ namespace IPC
 
 	void ThreadShared::Start()
 	{
-		reader_.Start();
+		if (!single_loop_)
+			reader_.Start();
 		wirter_.Start();
 	}
 
+	void ThreadShared::SetOptions(const ThreadOptions& options)
+	{
+		ThreadOptions reader_options = options;
+		ThreadOptions wirter_options = options;
+		if (!options.name.empty() && !single_loop_)
+		{
+			reader_options.name += L" reader";
+			wirter_options.name += L" writer";
+		}
+		reader_.SetOptions(reader_options);
+		wirter_.SetOptions(wirter_options);
+	}
+
+	bool ThreadShared::RunsOnCurrentThread() const
+	{
+		return reader_.RunsOnCurrentThread() || wirter_.RunsOnCurrentThread();
+	}
+
+	bool ThreadShared::RunsTasksOnCurrentThread() const
+	{
+		return wirter_.RunsOnCurrentThread();
+	}
+
+	void ThreadShared::WakeUp()
+	{
+		wirter_.WakeUp();
+	}
+
 	void ThreadShared::Stop()
 	{
 		if (handler_) handler_->OnQuit();
@@ -174,8 +202,8 @@ namespace IPC
 
 	void ThreadShared::Wait(DWORD timeout)
 	{
-		HANDLE threads[] = { reader_.thread_,wirter_.thread_ };
-		DWORD ret = ::WaitForMultipleObjects(2, threads, TRUE, timeout);
+		HANDLE threads[] = { wirter_.thread_,reader_.thread_ };
+		DWORD ret = ::WaitForMultipleObjects(single_loop_ ? 1 : 2, threads, TRUE, timeout);
 		assert(ret == WAIT_OBJECT_0);/*WAIT_TIMEOUT*/
 		if(reader_.thread_)
 		{
@@ -190,9 +218,9 @@ namespace IPC
 		handler_ = NULL;
 	}
 
-	void ThreadShared::PostTask(const Task & task)
+	void ThreadShared::PostPendingTask(PendingTask* pending)
 	{
-		wirter_.PostTask(task);
+		wirter_.PostPendingTask(pending);
 	}
 
 }
@@ -3,6 +3,7 @@
 #include "ipc/ipc_utils.h"
 #include "ipc/basic_thread.h"
 
+#include <algorithm>
 #include <functional>
 #include <queue>
 #include <list>
@@ -81,8 +82,13 @@ namespace IPC
 		class NotifyHandler {
 		public:
 			virtual ~NotifyHandler() {}
-			virtual void OnProcessWirte(HANDLE wait_event) = 0;
+			// Writer thread: one write pass, then sleep until |wait_event| is
+			// set or |timeout| passes.
+			virtual void OnProcessWirte(HANDLE wait_event, DWORD timeout) = 0;
 			virtual void OnProcessRead(HANDLE wait_event) = 0;
+			// Single-loop mode: one pass over both directions, then sleep until
+			// |wait_event| is set, the peer signals, or |timeout| passes.
+			virtual void OnProcessLoop(HANDLE wait_event, DWORD timeout) = 0;
 			virtual void OnQuit() = 0;
 		};
 		class ThreadReader : public basic_thread
@@ -101,7 +107,7 @@ namespace IPC
 				else
 				{
 					//do timeout check
-					::WaitForSingleObject(wait_event_, 1000);
+					::WaitForSingleObject(wait_event_, (std::min)(DelayedWorkTimeout(), static_cast<DWORD>(1000)));
 					::ResetEvent(wait_event_);
 				}
 
@@ -117,14 +123,18 @@ namespace IPC
 		private:
 			virtual void WaitForWork()
 			{
-				if (host_->handler_)
+				if (host_->handler_ && host_->single_loop_)
+				{
+					host_->handler_->OnProcessLoop(wait_event_, DelayedWorkTimeout());
+				}
+				else if (host_->handler_)
 				{
-					host_->handler_->OnProcessWirte(wait_event_);
+					host_->handler_->OnProcessWirte(wait_event_, DelayedWorkTimeout());
 				}
 				else
 				{
 					//do timeout check
-					::WaitForSingleObject(wait_event_, 1000);
+					::WaitForSingleObject(wait_event_, (std::min)(DelayedWorkTimeout(), static_cast<DWORD>(1000)));
 					::ResetEvent(wait_event_);
 				}
 
@@ -132,18 +142,31 @@ namespace IPC
 			ThreadShared* host_;
 		};
 
-		ThreadShared();
+		// With |single_loop| the writer thread services both directions and
+		// the reader thread is never started.
+		explicit ThreadShared(bool single_loop = false);
 		~ThreadShared();
 
 		void RegisterHandler(NotifyHandler* handler){handler_ = handler;}
+		bool single_loop() const { return single_loop_; }
 		virtual void Start();
 		virtual void Stop();
 		virtual void Wait(DWORD timeout);
+		// Applies to both the reader and the writer thread.
+		virtual void SetOptions(const ThreadOptions& options);
+		// True on either the reader or the writer thread.
+		virtual bool RunsOnCurrentThread() const;
+		// True on the writer thread only.
+		virtual bool RunsTasksOnCurrentThread() const;
+		// Wakes the writer thread.
+		virtual void WakeUp();
 
-		virtual void PostTask(const Task& task);
 	private:
+		// Tasks and timers run on the writer thread.
+		virtual void PostPendingTask(PendingTask* pending);
 
 		NotifyHandler* handler_;
+		const bool single_loop_;
 		ThreadReader reader_;
 		ThreadWirter wirter_;
 	};
@@ -120,4 +120,58 @@ namespace IPC
 		return mbyte;
 	}
 
+	int ProcessorCount()
+	{
+		SYSTEM_INFO info;
+		::GetSystemInfo(&info);
+		return info.dwNumberOfProcessors > 0 ? static_cast<int>(info.dwNumberOfProcessors) : 1;
+	}
+
+#ifdef _MSC_VER
+	namespace {
+
+		// Kept apart from SetCurrentThreadName: a function with __try may not
+		// hold objects that need unwinding.
+		void RaiseThreadNameException(const char* name)
+		{
+			const DWORD kVCThreadNameException = 0x406D1388;
+#pragma pack(push, 8)
+			struct THREADNAME_INFO {
+				DWORD dwType;      // Must be 0x1000.
+				LPCSTR szName;     // Pointer to name (in user addr space).
+				DWORD dwThreadID;  // Thread ID (-1=caller thread).
+				DWORD dwFlags;     // Reserved for future use, must be zero.
+			};
+#pragma pack(pop)
+			THREADNAME_INFO info = { 0x1000, name, static_cast<DWORD>(-1), 0 };
+			__try {
+				::RaiseException(kVCThreadNameException, 0, sizeof(info) / sizeof(ULONG_PTR),
+					reinterpret_cast<ULONG_PTR*>(&info));
+			}
+			__except (EXCEPTION_EXECUTE_HANDLER) {
+			}
+		}
+
+	}  // namespace
+#endif
+
+	void SetCurrentThreadName(const std::wstring& name)
+	{
+		// SetThreadDescription exists from Windows 10 1607 on.
+		typedef HRESULT(WINAPI* SetThreadDescriptionFn)(HANDLE, PCWSTR);
+		static SetThreadDescriptionFn set_description =
+			reinterpret_cast<SetThreadDescriptionFn>(::GetProcAddress(
+				::GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription"));
+		if (set_description)
+			set_description(::GetCurrentThread(), name.c_str());
+
+#ifdef _MSC_VER
+		// Older debuggers only learn thread names from this exception.
+		if (!::IsDebuggerPresent())
+			return;
+		std::string ascii = WideToASCII(name);
+		RaiseThreadNameException(ascii.c_str());
+#endif
+	}
+
 }
\ No newline at end of file
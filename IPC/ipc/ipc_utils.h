@@ -2,6 +2,8 @@
 #include "ipc/ipc_forwards.h"
 #include "ipc/ipc_common.h"
 
+#include <vector>
+
 namespace IPC
 {
 
@@ -79,10 +81,14 @@ namespace IPC
 		ipc_ull seq_;
 	};
 
+	// Holds a reference on an object with AddRef()/Release(). Copying takes
+	// another reference; moving hands the held one over without touching the
+	// reference count, so prefer std::move when the source is done with it.
 	template <class T>
 	class ScopedPtr
 	{
 	public:
+		ScopedPtr() : p_(NULL) {}
 		ScopedPtr(T* t)
 		{
 			p_ = t;
@@ -98,17 +104,36 @@ namespace IPC
 			if (p_)
 				p_->AddRef();
 		}
-		void operator=(const ScopedPtr<T>& r)
+		ScopedPtr(ScopedPtr<T>&& r) : p_(r.p_)
+		{
+			r.p_ = NULL;
+		}
+		ScopedPtr<T>& operator=(const ScopedPtr<T>& r)
 		{
+			if (r.p_)
+				r.p_->AddRef();
 			Clear();
 			p_ = r.p_;
-			if (p_)
-				p_->AddRef();
+			return *this;
+		}
+		ScopedPtr<T>& operator=(ScopedPtr<T>&& r)
+		{
+			if (this != &r)
+			{
+				Clear();
+				p_ = r.p_;
+				r.p_ = NULL;
+			}
+			return *this;
 		}
 		void Clear()
 		{
 			if (p_)
-				p_->Release();
+			{
+				T* p = p_;
+				p_ = NULL;
+				p->Release();
+			}
 		}
 		T* operator->() const
 		{
@@ -122,6 +147,52 @@ namespace IPC
 		T* p_;
 	};
 
+	// First-in first-out queue over a std::vector. Popped slots are reused once
+	// the queue drains or the dead prefix outgrows the live part, so a queue
+	// that has reached its working size does not allocate again. std::deque
+	// is avoided because some implementations allocate a block every couple
+	// of pointer-sized elements.
+	template <class T>
+	class FifoQueue
+	{
+	public:
+		FifoQueue() : head_(0) {}
+
+		bool empty() const { return head_ == items_.size(); }
+		size_t size() const { return items_.size() - head_; }
+		T& front() { return items_[head_]; }
+		// The |i|th item from the front.
+		T& operator[](size_t i) { return items_[head_ + i]; }
+
+		void push(const T& item) { items_.push_back(item); }
+		void push(T&& item) { items_.push_back(std::move(item)); }
+
+		void pop()
+		{
+			items_[head_] = T();
+			if (++head_ == items_.size())
+			{
+				items_.clear();
+				head_ = 0;
+			}
+			else if (head_ > items_.size() / 2)
+			{
+				items_.erase(items_.begin(), items_.begin() + head_);
+				head_ = 0;
+			}
+		}
+
+	private:
+		std::vector<T> items_;
+		size_t head_;
+	};
+
+	// Number of logical processors, at least 1.
+	int ProcessorCount();
+
+	// Names the calling thread for debuggers and profilers.
+	void SetCurrentThreadName(const std::wstring& name);
+
 	int RandInt(int min, int max);
 
 	ipc_ull RandGenerator(ipc_ull range);